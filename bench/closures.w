@@ -0,0 +1,15 @@
+# Creating and calling closures
+func make_counter(start) {
+    func count() {
+        start = start + 1;
+        return start;
+    }
+    return count;
+}
+total = 0;
+for i in range(800) {
+    counter = make_counter(i);
+    counter();
+    total = total + counter();
+}
+print(total);
@@ -0,0 +1,17 @@
+# Inserting and looking up integer and string keys
+d = {};
+for i in range(2000) {
+    d[i] = i * 3;
+}
+total = 0;
+for round in range(5) {
+    for i in range(2000) {
+        total = total + d[i];
+    }
+}
+names = {"alpha" -> 1, "beta" -> 2, "gamma" -> 3, "delta" -> 4};
+hits = 0;
+for i in range(20000) {
+    hits = hits + names["gamma"] + names["alpha"];
+}
+print(total, hits);
@@ -0,0 +1,15 @@
+# Growing a list and walking it
+items = [];
+for i in range(4000) {
+    list_append(items, i);
+}
+total = 0;
+for x in items {
+    total = total + x;
+}
+i = 0;
+while i < list_count(items) {
+    items[i] = items[i] * 2;
+    i = i + 1;
+}
+print(list_count(items), total, items[3999]);
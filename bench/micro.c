@@ -0,0 +1,404 @@
+#include "common.h"
+#include "gc.h"
+#include "lexer.h"
+#include "persistent.h"
+#include "symbol.h"
+#include "value.h"
+#include "vm.h"
+
+#include <time.h>
+
+// Microbenchmarks for the runtime's primitives, linked straight
+// against its objects (make bench). Each one is timed at growing
+// sizes, and the growth column is how much slower an operation got
+// from the previous size: about 1 for constant time, about the size
+// ratio for linear. A jump there is an algorithmic regression in that
+// subsystem, which whole-program timings in run_bench tend to blur.
+//
+//   bin/winter-bench              run everything
+//   bin/winter-bench dict lexer   only benchmarks whose name contains one of these
+
+// Each measurement repeats its pass until it has run this long
+#define MICRO_MIN_NSEC 20000000ULL
+// and is the best of this many measurements
+#define MICRO_ROUNDS 3
+
+static const size_t sizes[] = { 16, 256, 4096 };
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static uint64_t now_nsec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static Assoc_Source no_assoc()
+{
+	return assoc_source_new(NULL, 0, 0, 0);
+}
+
+// : Benchmarks
+
+// Every benchmark builds its fixture in setup, untimed. A pass is
+// timed and returns how many operations it did; cleanup runs untimed
+// after each pass, and teardown once at the end.
+typedef struct {
+	const char * name;
+	const char * unit;
+	void (*setup)(size_t n);
+	size_t (*pass)(size_t n);
+	void (*cleanup)();
+	void (*teardown)();
+} Micro_Bench;
+
+static GC gc;
+static Value fixture;
+// Written by passes so the compiler can't drop their work
+static volatile uintptr_t sink;
+
+static void nothing() {}
+
+static void heap_setup()
+{
+	gc = gc_new();
+	gc_make_current(&gc);
+}
+
+static void heap_teardown()
+{
+	gc_free(&gc);
+}
+
+static void collect()
+{
+	gc_collect(&gc);
+}
+
+// : Dictionary lookup
+
+static void dict_int_setup(size_t n)
+{
+	heap_setup();
+	fixture = value_new_dictionary();
+	for (size_t i = 0; i < n; i++) {
+		value_add_pair_dictionary(fixture, value_new_integer(i), value_new_integer(i * 3));
+	}
+}
+
+static Value * string_keys;
+
+static void dict_string_setup(size_t n)
+{
+	heap_setup();
+	fixture = value_new_dictionary();
+	for (size_t i = 0; i < n; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "key_%zu", i);
+		Value key = value_new_string(name);
+		sb_push(string_keys, key);
+		value_add_pair_dictionary(fixture, key, value_new_integer(i));
+	}
+}
+
+static void dict_string_teardown()
+{
+	sb_free(string_keys);
+	string_keys = NULL;
+	heap_teardown();
+}
+
+// Hits every key once, in insertion order
+static size_t dict_int_pass(size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		sink += (uintptr_t) value_index_dictionary(fixture, value_new_integer(i));
+	}
+	return n;
+}
+
+static size_t dict_string_pass(size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		sink += (uintptr_t) value_index_dictionary(fixture, string_keys[i]);
+	}
+	return n;
+}
+
+// :\ Dictionary lookup
+
+// : Persistent collections
+
+// Modified copies of a vector or map of n elements, each of which
+// should cost O(log n) however big the original is
+#define PERSISTENT_BATCH 64
+
+static void vector_setup(size_t n)
+{
+	heap_setup();
+	Value list = value_new_list();
+	for (size_t i = 0; i < n; i++) {
+		value_append_list(list, value_new_integer(i));
+	}
+	fixture = vector_from_list(list);
+	value_modify_refcount(fixture, 1);
+}
+
+static size_t vector_set_pass(size_t n)
+{
+	for (int i = 0; i < PERSISTENT_BATCH; i++) {
+		Value copy = vector_set(fixture, (i * 7919) % n, value_new_integer(i));
+		sink += value_vector(copy)->count;
+	}
+	return PERSISTENT_BATCH;
+}
+
+static void hamt_setup(size_t n)
+{
+	heap_setup();
+	fixture = map_new();
+	for (size_t i = 0; i < n; i++) {
+		fixture = map_set(fixture, value_new_integer(i), value_new_integer(i));
+	}
+	value_modify_refcount(fixture, 1);
+	// Drop the maps made along the way
+	gc_collect(&gc);
+}
+
+static size_t map_set_pass(size_t n)
+{
+	for (int i = 0; i < PERSISTENT_BATCH; i++) {
+		Value copy = map_set(fixture, value_new_integer((i * 7919) % n), value_none());
+		sink += value_map(copy)->count;
+	}
+	return PERSISTENT_BATCH;
+}
+
+// :\ Persistent collections
+
+// : List append
+
+static void list_setup(size_t n)
+{
+	heap_setup();
+}
+
+static size_t list_append_pass(size_t n)
+{
+	Value list = value_new_list();
+	for (size_t i = 0; i < n; i++) {
+		value_append_list(list, value_new_integer(i));
+	}
+	sink += value_list(list)->size;
+	return n;
+}
+
+// :\ List append
+
+// : GC
+
+// A live heap of n allocations, and passes that each allocate a batch
+// of garbage and collect it, so the cost of a collection is spread
+// over the allocations it frees
+#define GC_BATCH 64
+
+static void gc_setup(size_t n)
+{
+	heap_setup();
+	for (size_t i = 0; i < n; i++) {
+		gc_modify_refcount(current_alloc(32, VALUE_NONE), 1);
+	}
+}
+
+static size_t gc_pass(size_t n)
+{
+	for (int i = 0; i < GC_BATCH; i++) {
+		sink += (uintptr_t) current_alloc(32, VALUE_NONE);
+	}
+	sink += gc_collect(&gc);
+	return GC_BATCH;
+}
+
+// :\ GC
+
+// : Cast
+
+// A list of n lists of four integers, cast to a string; an operation
+// is one inner list
+static void cast_setup(size_t n)
+{
+	heap_setup();
+	fixture = value_new_list();
+	for (size_t i = 0; i < n; i++) {
+		Value inner = value_new_list();
+		for (int j = 0; j < 4; j++) {
+			value_append_list(inner, value_new_integer(i * 4 + j));
+		}
+		value_append_list(fixture, inner);
+	}
+	value_modify_refcount(fixture, 1);
+}
+
+static size_t cast_pass(size_t n)
+{
+	Value string = value_cast(fixture, VALUE_STRING, no_assoc());
+	sink += value_string_size(string);
+	return n;
+}
+
+// :\ Cast
+
+// : Variable_Map
+
+static Variable_Map map;
+static const char ** map_names;
+
+static void map_setup(size_t n)
+{
+	map = variable_map_new();
+	for (size_t i = 0; i < n; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "variable_%zu", i);
+		sb_push(map_names, symbol_intern_name(name));
+		variable_map_update(&map, map_names[i], value_new_integer(i));
+	}
+}
+
+static size_t map_pass(size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		sink += (uintptr_t) variable_map_index(&map, map_names[i]);
+	}
+	return n;
+}
+
+static void map_teardown()
+{
+	for (int i = 0; i < sb_count(map_names); i++) {
+		free(map.values[i]);
+	}
+	sb_free(map_names);
+	sb_free(map.names);
+	sb_free(map.values);
+	map_names = NULL;
+}
+
+// :\ Variable_Map
+
+// : Lexer
+
+// n lines of generated source, each with its own identifier, so the
+// number of distinct names grows along with the source
+static char * lexer_source;
+
+static void lexer_setup(size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		char line[128];
+		int len = snprintf(line, sizeof(line),
+						   "value_%zu = (value_%zu * 3 + 1.5) as string; # line %zu\n",
+						   i, i / 2, i);
+		memcpy(sb_add(lexer_source, len), line, len);
+	}
+	sb_push(lexer_source, '\0');
+}
+
+// Each pass lexes the whole source with a fresh lexer, so interned
+// names don't carry over from the last one
+static size_t lexer_pass(size_t n)
+{
+	Lexer * lexer = lexer_alloc(lexer_source);
+	size_t tokens = 1;
+	while (lexer->token.type != TOKEN_EOF) {
+		lexer_advance(lexer);
+		tokens++;
+	}
+	sink += lexer->position;
+	for (int i = 0; i < sb_count(lexer->interned_strings); i++) {
+		free((char*) lexer->interned_strings[i]);
+	}
+	sb_free(lexer->interned_strings);
+	free(lexer);
+	return tokens;
+}
+
+static void lexer_teardown()
+{
+	sb_free(lexer_source);
+	lexer_source = NULL;
+}
+
+// :\ Lexer
+
+static Micro_Bench benches[] = {
+	{ "dict_index_int",    "lookup", dict_int_setup,    dict_int_pass,    nothing, heap_teardown },
+	{ "dict_index_string", "lookup", dict_string_setup, dict_string_pass, nothing, dict_string_teardown },
+	{ "list_append",       "append", list_setup,        list_append_pass, collect, heap_teardown },
+	{ "vector_set",        "copy",   vector_setup,      vector_set_pass,  collect, heap_teardown },
+	{ "map_set",           "copy",   hamt_setup,        map_set_pass,     collect, heap_teardown },
+	{ "gc_alloc_collect",  "alloc",  gc_setup,          gc_pass,          nothing, heap_teardown },
+	{ "cast_nested_list",  "item",   cast_setup,        cast_pass,        collect, heap_teardown },
+	{ "variable_map",      "lookup", map_setup,         map_pass,         nothing, map_teardown },
+	{ "lexer_tokens",      "token",  lexer_setup,       lexer_pass,       nothing, lexer_teardown },
+};
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+// :\ Benchmarks
+
+// : Harness
+
+// Nanoseconds per operation, best of MICRO_ROUNDS
+static double measure(Micro_Bench * bench, size_t n)
+{
+	double best = 0;
+	for (int round = 0; round < MICRO_ROUNDS; round++) {
+		uint64_t elapsed = 0;
+		size_t ops = 0;
+		while (elapsed < MICRO_MIN_NSEC) {
+			uint64_t start = now_nsec();
+			ops += bench->pass(n);
+			elapsed += now_nsec() - start;
+			bench->cleanup();
+		}
+		double per_op = (double) elapsed / ops;
+		if (round == 0 || per_op < best) best = per_op;
+	}
+	return best;
+}
+
+static bool selected(int argc, char ** argv, const char * name)
+{
+	if (argc < 2) return true;
+	for (int i = 1; i < argc; i++) {
+		if (strstr(name, argv[i])) return true;
+	}
+	return false;
+}
+
+int main(int argc, char ** argv)
+{
+	printf("%-20s %8s %12s %8s\n", "benchmark", "n", "ns/op", "growth");
+	for (size_t b = 0; b < NUM_BENCHES; b++) {
+		Micro_Bench * bench = benches + b;
+		if (!selected(argc, argv, bench->name)) continue;
+		double last = 0;
+		for (size_t s = 0; s < NUM_SIZES; s++) {
+			size_t n = sizes[s];
+			bench->setup(n);
+			double per_op = measure(bench, n);
+			bench->teardown();
+			printf("%-20s %8zu %12.1f", bench->name, n, per_op);
+			if (s > 0) {
+				printf(" %7.1fx", per_op / last);
+			} else {
+				printf(" %8s", "");
+			}
+			printf("  ns/%s\n", bench->unit);
+			fflush(stdout);
+			last = per_op;
+		}
+	}
+	return 0;
+}
+
+// :\ Harness
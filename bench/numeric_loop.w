@@ -0,0 +1,14 @@
+# Integer and float arithmetic in counting loops
+total = 0;
+for i in range(40000) {
+    total = total + i * 3 - i;
+}
+print(total);
+
+x = 0.0;
+i = 0;
+while i < 40000 {
+    x = x + i / 7;
+    i = i + 1;
+}
+print(x > 0.0);
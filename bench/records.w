@@ -0,0 +1,15 @@
+# Reading and writing record fields
+record Point {
+    x,
+    y,
+}
+record Particle {
+    position,
+    velocity,
+}
+p = Particle(Point(0, 0), Point(1, 2));
+for step in range(20000) {
+    p.position.x = p.position.x + p.velocity.x;
+    p.position.y = p.position.y + p.velocity.y;
+}
+print(p.position.x, p.position.y);
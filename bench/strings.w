@@ -0,0 +1,8 @@
+# Casting values to strings and printing them
+values = [1, 2.5, true, "text", [1, 2, 3], {"k" -> [4, 5]}];
+for i in range(500) {
+    for v in values {
+        s = v as string;
+    }
+    print(i, values);
+}
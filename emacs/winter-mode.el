@@ -13,7 +13,7 @@
   '("none" "true" "false" "return" "if"
 	"else" "func" "loop" "break" "continue"
 	"or" "and" "as" "int" "float" "bool"
-	"string" "list" "while" "record"))
+	"string" "list" "while" "record" "yield" "for" "in"))
 
 (defun get-winter-keywords ()
   (regexp-opt winter-keywords 'symbols))
@@ -94,9 +94,11 @@ typedef enum {
 	STMT_ASSIGN,
 	STMT_PRINT,
 	STMT_RETURN,
+	STMT_YIELD,
 	STMT_IF,
 	STMT_LOOP,
 	STMT_WHILE,
+	STMT_FOR,
 	STMT_BREAK,
 	STMT_CONTINUE,
 	STMT_FUNC_DECL,
@@ -117,6 +119,9 @@ typedef struct Stmt {
 		struct {
 			Expr * expr;
 		} _return;
+		struct {
+			Expr * expr;
+		} _yield;
 		struct {
 			Expr ** conditions;
 			struct Stmt *** bodies;
@@ -129,6 +134,11 @@ typedef struct Stmt {
 			Expr * condition;
 			struct Stmt ** body;
 		} _while;
+		struct {
+			const char * name;
+			Expr * iterable;
+			struct Stmt ** body;
+		} _for;
 		struct {
 			const char * name;
 			const char ** parameters;
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "common.h"
+#include "lexer.h"
+#include "vm.h"
+
+// : BC_Cache
+
+// On-disk cache of compiled bytecode (.wbc files). A cache file holds
+// every top-level unit of a script, in execution order, and is keyed
+// on a hash of the source it was compiled from. Loading maps the file
+// into memory and rebuilds the BC_Chunk arrays directly from it, so a
+// warm start never touches the lexer, parser or compiler.
+
+uint64_t bc_cache_hash_source(const char * source);
+
+// Returns an sb of bytecode units, or NULL if the cache is missing,
+// stale or unreadable. Names and string literals point into the
+// mapped file, which stays mapped for the rest of the process.
+BC_Chunk ** bc_cache_load(const char * path, uint64_t source_hash, Lexer * lexer);
+
+// Writes atomically (temporary file + rename), so concurrent runs of
+// the same script never observe a half-written cache. Failure to
+// write is not an error; the next run just compiles again.
+void bc_cache_write(const char * path, uint64_t source_hash, BC_Chunk ** units);
+
+// :\ BC_Cache
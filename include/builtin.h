@@ -11,9 +11,14 @@
 typedef size_t Builtin;
 //
 
+// Builtins get the machine that called them
+typedef struct Winter_Machine Winter_Machine;
+
 extern const char * builtin_names[];
 extern int builtin_arg_counts[];
-extern Value (*builtin_functions[])(Value*, size_t, Assoc_Source);
+extern bool builtin_purity[];
+extern bool builtin_blocking[];
+extern Value (*builtin_functions[])(Winter_Machine*, Value*, size_t, Assoc_Source);
 
 enum {
 	BUILTIN_PRINT,
@@ -23,5 +28,36 @@ enum {
 	BUILTIN_LIST_APPEND,
 	BUILTIN_LIST_POP,
 	BUILTIN_LIST_COUNT,
+	BUILTIN_SPAWN,
+	BUILTIN_JOIN,
+	BUILTIN_CHANNEL,
+	BUILTIN_SEND,
+	BUILTIN_RECEIVE,
+	BUILTIN_PAR_MAP,
+	BUILTIN_PAR_FILTER,
+	BUILTIN_PAR_REDUCE,
+	BUILTIN_PURE,
+	BUILTIN_NEXT,
+	BUILTIN_DONE,
+	BUILTIN_GO,
+	BUILTIN_YIELD_FIBER,
+	BUILTIN_FD_OPEN,
+	BUILTIN_FD_READ,
+	BUILTIN_FD_WRITE,
+	BUILTIN_FD_CLOSE,
+	BUILTIN_FD_PIPE,
+	BUILTIN_UNIX_LISTEN,
+	BUILTIN_UNIX_ACCEPT,
+	BUILTIN_UNIX_CONNECT,
+	BUILTIN_RANGE,
+	BUILTIN_DICT_REMOVE,
+	BUILTIN_VECTOR,
+	BUILTIN_VECTOR_APPEND,
+	BUILTIN_VECTOR_SET,
+	BUILTIN_VECTOR_COUNT,
+	BUILTIN_MAP,
+	BUILTIN_MAP_SET,
+	BUILTIN_MAP_REMOVE,
+	BUILTIN_MAP_COUNT,
 	NUM_BUILTINS,
 };
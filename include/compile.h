@@ -8,3 +8,4 @@ typedef struct {
 } Compiler;
 
 void compile_statement(Compiler * compiler, Stmt * stmt);
+void compile_program(Compiler * compiler, Stmt ** program);
@@ -21,6 +21,10 @@ Assoc_Source assoc_source_new(Lexer * lexer,
 							  size_t len);
 
 Assoc_Source assoc_source_eof(Lexer * lexer);
+
+// The source line assoc is on, minus indentation, for reports. Not
+// NUL-terminated at the end of the line, hence len.
+const char * assoc_source_line(Assoc_Source assoc, int * len);
 // :\ Assoc_Source
 
 // : Fatal functions
@@ -6,28 +6,47 @@
 
 typedef struct {
 	void ** allocations;
+	// Only set for --memprofile, along with the source of the
+	// instruction doing the allocating
+	struct Alloc_Profile * profile;
+	Assoc_Source site;
 } GC;
 
-// TODO(pixlark): I can't think of why this shouldn't be global...
-extern GC global_gc;
+GC gc_new();
+void gc_free(GC * gc);
 
-void global_init();
+// The heap that values are allocated from on this thread. Every
+// Winter_Machine owns its own heap and makes it current when it is
+// set up to run, so independent machines can live on separate
+// threads of the same process.
+extern _Thread_local GC * current_gc;
+
+void gc_make_current(GC * gc);
 
 size_t gc_allocations(GC * gc);
-#define global_allocations() gc_allocations(&global_gc)
+#define current_allocations() gc_allocations(current_gc)
 
-void * gc_alloc(GC * gc, size_t size);
-#define global_alloc(size) gc_alloc(&global_gc, (size))
+// tag is the Value_Type the allocation is for, which the memory
+// profiler reports it under
+void * gc_alloc(GC * gc, size_t size, int tag);
+#define current_alloc(size, tag) gc_alloc(current_gc, (size), (tag))
 
-void * gc_realloc(GC * gc, void * external, size_t new_size);
-#define global_realloc(ptr, size) gc_realloc(&global_gc, (ptr), (size))
+void * gc_realloc(GC * gc, void * external, size_t new_size, int tag);
+#define current_realloc(ptr, size, tag) gc_realloc(current_gc, (ptr), (size), (tag))
 
 void gc_modify_refcount(void * ptr, int change);
 
 int32_t gc_get_refcount(void * ptr);
 
-void gc_collect(GC * gc);
-#define global_collect() gc_collect(&global_gc)
+// Called with the allocation just before it's freed, for allocations
+// that own memory or references outside of themselves
+typedef void (*GC_Finalizer)(void * ptr);
+void gc_set_finalizer(void * ptr, GC_Finalizer finalizer);
 
-// :\ GC
+// Returns how many allocations were freed
+size_t gc_collect(GC * gc);
 
+// Moves every allocation in from into gc, leaving from empty
+void gc_adopt(GC * gc, GC * from);
+
+// :\ GC
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "common.h"
+#include "gc.h"
+#include "value.h"
+#include "vm.h"
+
+// : Message
+
+// A value in transit between machines. Sending deep copies the value
+// into the message's own heap; receiving hands that whole heap over to
+// the receiving machine, so values cross threads without refcounts
+// ever being touched by two threads.
+
+typedef struct {
+	GC heap;
+	Value value;
+} Message;
+
+Message message_new(Value value);
+// An empty list that values can be copied onto one at a time
+Message message_new_list();
+void message_append(Message * message, Value value);
+Value message_receive(Message * message);
+
+// :\ Message
+
+// : Winter_Isolate
+
+// A function running in a machine of its own on another thread. The
+// isolate starts with copies of the arguments and of every global the
+// function can reach; nothing else is shared with the spawner.
+
+struct Winter_Isolate {
+	pthread_t thread;
+	Message start;
+	Message result;
+	Assoc_Source assoc;
+	atomic_bool joined;
+};
+
+Winter_Isolate * isolate_spawn(Winter_Machine * wm, Value func,
+							   Value * args, size_t arg_count, Assoc_Source assoc);
+Value isolate_join(Winter_Isolate * isolate, Assoc_Source assoc);
+
+// Names (sb) of every global the values could look up when they run
+const char ** isolate_reachable_globals(Winter_Machine * wm, Value * values, size_t count);
+// {name -> global} in the current heap, for sending to another machine
+Value isolate_globals_dictionary(Winter_Machine * wm, const char ** names);
+// Binds a received globals dictionary in wm's global frame
+void isolate_bind_globals(Winter_Machine * wm, Value globals);
+
+// :\ Winter_Isolate
+
+// : Winter_Channel
+
+// Unbounded FIFO of messages that any number of machines can send to
+// and receive from. Channels and isolates aren't owned by any heap and
+// live for the rest of the process.
+//
+// A thread with nothing else to do waits on the condition variable. A
+// fiber waits in its machine's reactor on the channel's event fd
+// instead, which is readable whenever the queue isn't empty, so the
+// machine can sleep in epoll_wait alongside its other fds.
+
+struct Winter_Channel {
+	pthread_mutex_t lock;
+	pthread_cond_t nonempty;
+	Message * queue;
+	size_t head;
+	// -1 until a fiber first waits on the channel
+	int event_fd;
+};
+
+Winter_Channel * channel_alloc();
+void channel_send(Winter_Channel * channel, Value value);
+Value channel_receive(Winter_Channel * channel);
+// Doesn't wait; false if there was nothing to take
+bool channel_try_receive(Winter_Channel * channel, Value * value);
+// For parking a fiber until there's something to take
+int channel_wait_fd(Winter_Channel * channel, Assoc_Source assoc);
+
+// :\ Winter_Channel
@@ -21,6 +21,9 @@ typedef enum {
 	TOKEN_CONTINUE,
 	TOKEN_RARROW,
 	TOKEN_RECORD,
+	TOKEN_YIELD,
+	TOKEN_FOR,
+	TOKEN_IN,
 
 	TOKEN_AS,
 	TOKEN_INT,
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <signal.h>
+
+#include "common.h"
+
+// : Alloc_Profile
+
+// Allocation-site memory profiler behind --memprofile. While a GC has
+// a profile attached, every allocation is recorded against the source
+// of the instruction that made it and the type of value it's for, and
+// forgotten again when it's freed. The report gives live and total
+// bytes per site, so leaks and allocation-heavy lines stand out.
+
+typedef struct Alloc_Profile Alloc_Profile;
+
+Alloc_Profile * alloc_profile_new();
+void alloc_profile_free(Alloc_Profile * profile);
+
+// allocation is the GC's own pointer to it, header included
+void alloc_profile_add(Alloc_Profile * profile, void * allocation, size_t size,
+					   Assoc_Source site, int tag);
+// Allocations the profile never saw are ignored
+void alloc_profile_remove(Alloc_Profile * profile, void * allocation);
+
+// Sites sorted by live bytes, then total bytes
+void alloc_profile_report(Alloc_Profile * profile);
+
+// Set from a SIGUSR1 handler to ask for a report mid-run
+extern volatile sig_atomic_t alloc_profile_requested;
+void alloc_profile_catch_signal();
+
+// :\ Alloc_Profile
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// : Op_Stats
+
+// Execution counts per instruction and per pair of instructions run
+// back to back, for --opstats. Only the machine the stats are attached
+// to is counted; isolates and par_map workers run on their own
+// machines and don't show up.
+
+typedef struct Op_Stats {
+	uint64_t counts[NUM_INSTRUCTIONS];
+	// [first][second]
+	uint64_t pairs[NUM_INSTRUCTIONS][NUM_INSTRUCTIONS];
+	// -1 before the first instruction
+	int last;
+} Op_Stats;
+
+Op_Stats * op_stats_alloc();
+void op_stats_free(Op_Stats * stats);
+// Prints both tables to stderr, most frequent first
+void op_stats_report(Op_Stats * stats);
+
+static inline void op_stats_count(Op_Stats * stats, enum Instruction instr)
+{
+	stats->counts[instr]++;
+	if (stats->last >= 0) stats->pairs[stats->last][instr]++;
+	stats->last = instr;
+}
+
+// :\ Op_Stats
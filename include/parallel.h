@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+#include "vm.h"
+
+// : Parallel
+
+// Data-parallel operations over lists, run on the worker pool. The
+// list is cut into chunks; each worker gets its own machine holding
+// copies of the function and the globals it can reach, and copies each
+// element in as it gets to it. The calling machine is blocked the whole
+// time, so its heap is only ever read. Results are copied out per chunk
+// and put back together in list order, so the output is the same as a
+// sequential run.
+//
+// Only pure functions are accepted: ones that, as far as the bytecode
+// shows, never call a builtin with side effects or mutate a list, dict
+// or record in place, and only call other such functions. Anything
+// else can be vouched for with pure(). The same goes for any function
+// in the list, since the function can call what it's handed.
+
+// Whether value, and every function it holds, is pure
+bool parallel_is_pure(Winter_Machine * wm, Value value);
+
+Value parallel_map(Winter_Machine * wm, Value func, Value list, Assoc_Source assoc);
+Value parallel_filter(Winter_Machine * wm, Value func, Value list, Assoc_Source assoc);
+// func has to be associative; chunks are reduced independently and
+// their results combined left to right, starting from init
+Value parallel_reduce(Winter_Machine * wm, Value func, Value list, Value init,
+					  Assoc_Source assoc);
+
+// :\ Parallel
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+
+// : Persistent collections
+
+// Vectors and maps never change once made. Setting, appending or
+// removing gives a new collection that shares every node with the old
+// one except the O(log n) on the path to the change, so keeping a
+// snapshot of a large collection costs next to nothing.
+//
+// The header is a heap allocation like any other value, but the
+// nodes are malloc'd and refcounted among themselves, since any
+// number of headers can share them. Each node holds one reference to
+// the values in it, so refcount changes to a vector or map stop at
+// the header instead of walking every element.
+
+// Vectors are 32-way tries of their elements, in index order
+#define VECTOR_BITS 5
+#define VECTOR_WIDTH (1 << VECTOR_BITS)
+
+Value vector_new();
+Value vector_from_list(Value list);
+// NULL if i is out of range
+Value * vector_index(Winter_Vector * vector, int i);
+Value vector_append(Value vector, Value value);
+Value vector_set(Value vector, int i, Value value);
+
+// Maps are hash array mapped tries keyed on value_hash, with the same
+// key semantics as dictionaries. Their order is the hashes' order,
+// not insertion order.
+Value map_new();
+Value map_from_dictionary(Value dict);
+Value * map_index(Winter_Map * map, Value key);
+// Replaces the value if the key is already there
+Value map_set(Value map, Value key, Value value);
+// The map without the key in result, or false if it isn't there
+bool map_remove(Value map, Value key, Value * result);
+
+typedef void (*Map_Visitor)(void * data, Value key, Value value);
+void map_visit(Winter_Map * map, Map_Visitor visit, void * data);
+// A new list of every key
+Value map_keys(Winter_Map * map);
+
+// Copies into the current heap with copy applied to every element, key
+// and value, for moving a collection to another machine
+typedef Value (*Value_Copier)(void * context, Value value);
+Value vector_copy(Winter_Vector * vector, Value_Copier copy, void * context);
+Value map_copy(Winter_Map * map, Value_Copier copy, void * context);
+
+// :\ Persistent collections
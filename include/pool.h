@@ -0,0 +1,20 @@
+#pragma once
+
+#include "common.h"
+
+// : Pool
+
+// A fixed set of worker threads, one per core, started the first time
+// it's used. pool_run hands out task indices to the workers and blocks
+// until every task has run. Each worker starts on its own contiguous
+// share of the tasks and then steals from the others' shares.
+
+typedef void (*Pool_Task)(void * context, size_t task, size_t worker);
+
+size_t pool_worker_count();
+
+// Tasks submitted from inside a pool worker run inline, on that
+// worker, so nested parallel operations can't deadlock the pool
+void pool_run(size_t task_count, Pool_Task task, void * context);
+
+// :\ Pool
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "common.h"
+#include "vm.h"
+
+// : Profile
+
+// Sampling profiler behind --profile. A CPU-time timer raises SIGPROF
+// every millisecond, and the handler does nothing but count the tick.
+// The profiled machine notices at its next instruction and takes the
+// sample there, where its call stack is consistent: the line of the
+// instruction about to run and the functions on the stack, weighted by
+// the ticks since the last sample. Time a machine spends blocked in a
+// builtin (joining an isolate, waiting on par_map workers) lands on
+// the line making the call.
+
+extern atomic_int profile_ticks;
+extern Winter_Machine * profile_machine;
+
+void profile_start(Winter_Machine * wm);
+// Stops the timer, reports hits per line and per function on stderr,
+// and writes the samples to folded_path as folded stacks, which
+// flamegraph.pl and compatible tools read
+void profile_finish(const char * folded_path);
+
+void profile_sample(Winter_Machine * wm, BC_Chunk chunk);
+
+// Checked before every instruction, so keep it to two loads
+static inline bool profile_due(Winter_Machine * wm)
+{
+	return atomic_load_explicit(&profile_ticks, memory_order_relaxed) != 0 &&
+		wm == profile_machine;
+}
+
+// :\ Profile
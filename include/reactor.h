@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common.h"
+#include "error.h"
+
+// : Reactor
+
+// Parks fibers on file descriptors until they're ready, using epoll.
+// Each machine has one, which its scheduler polls whenever it switches
+// fibers and waits on when there's nothing else to run.
+
+typedef struct Fiber Fiber;
+
+typedef struct {
+	Fiber ** fibers; // sb
+	// Everything they're waiting for, together
+	uint32_t events;
+} Reactor_Waiters;
+
+typedef struct {
+	// Created the first time a fiber waits
+	int epoll_fd;
+	// Indexed by fd
+	Reactor_Waiters * waiters;
+	size_t parked;
+} Reactor;
+
+Reactor reactor_new();
+void reactor_free(Reactor * reactor);
+
+// events are EPOLLIN/EPOLLOUT. Any number of fibers can wait on the
+// same fd; they all wake when it's ready, and any that still can't go
+// through park again.
+void reactor_park(Reactor * reactor, int fd, uint32_t events,
+				  Fiber * fiber, Assoc_Source assoc);
+
+// Appends the fibers whose fds are ready to the run queue. timeout is
+// in milliseconds, -1 to wait for at least one.
+void reactor_wait(Reactor * reactor, Fiber *** run_queue, int timeout);
+
+// :\ Reactor
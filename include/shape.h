@@ -0,0 +1,50 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+
+// : Shape
+
+// Hidden classes for dictionaries used as objects. A shape is an
+// ordered list of string keys, and a dictionary with that shape keeps
+// the value for its i-th key in slot i. Adding a key moves to a child
+// shape, and dictionaries built up the same way end up sharing one, so
+// that an access site which has seen the shape before knows the slot
+// without looking at the key.
+//
+// Shapes are shared by every machine in the process and never freed:
+// a shape is immutable once made, and only making transitions takes a
+// lock. The tree is kept small by refusing transitions past
+// SHAPE_MAX_KEYS keys or SHAPE_MAX_SHAPES shapes in total, at which
+// point dictionaries fall back to hashing.
+
+#define SHAPE_MAX_KEYS 16
+#define SHAPE_MAX_SHAPES 4096
+
+typedef struct Dict_Shape Dict_Shape;
+
+struct Dict_Shape {
+	// Unique and never zero, for inline caches
+	uint64_t id;
+	size_t count;
+	// Every key, in slot order. Keys are symbols (see symbol.h), so
+	// they need no refcounting.
+	Value * keys;
+	// Shapes one key on from this one, guarded by the shape lock
+	Dict_Shape ** transitions; // sb
+};
+
+// The shape with no keys, which new dictionaries start out with
+Dict_Shape * shape_root();
+
+// Slot of the key in the shape, or -1
+int shape_find(Dict_Shape * shape, const char * chars, size_t len);
+// The same for a key that's a symbol's characters, by address
+int shape_find_symbol(Dict_Shape * shape, const char * symbol);
+
+// The shape with the key added as the next slot, or NULL if that
+// would make the shape or the tree too big. The key must not already
+// be in the shape.
+Dict_Shape * shape_add(Dict_Shape * shape, const char * chars, size_t len);
+
+// :\ Shape
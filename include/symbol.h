@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+
+// : Symbol
+
+// Names the program uses (variables, parameters, fields and string
+// literals) are interned once for the whole process, so two symbols
+// are the same name exactly when their characters are at the same
+// address. Variable maps, field lookups and shapes compare names that
+// way, and so does string equality when both sides are symbols.
+//
+// A symbol is a constant string (see value_new_constant_string), and
+// every constant string is a symbol. The table is shared by every
+// machine, guarded by a lock, and never shrinks. Interning happens as
+// bytecode is built or loaded rather than as it runs.
+
+// The symbol with these characters, made if it's the first time
+Value symbol_intern(const char * chars);
+
+// Just the characters, for instructions and variable maps
+#define symbol_intern_name(chars) (value_string(symbol_intern(chars))->contents)
+
+// :\ Symbol
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// : Trace
+
+// Timeline of one machine's run for --trace, in Chrome's trace event
+// format (chrome://tracing, Perfetto). Records calls and returns of
+// user functions, garbage collections (long ones as slices, all of
+// them as a running count of objects freed), builtins
+// that can block, and waits on the reactor. Each fiber gets its own
+// track, so calls nest properly even when fibers interleave.
+
+extern Winter_Machine * trace_machine;
+
+static inline bool tracing(Winter_Machine * wm)
+{
+	return wm == trace_machine;
+}
+
+// Fatal if the file can't be opened
+void trace_start(Winter_Machine * wm, const char * path);
+void trace_finish();
+
+// Microseconds since the trace started
+double trace_now();
+
+// A frame for the named function was pushed or popped
+void trace_enter(Winter_Machine * wm, const char * name);
+void trace_exit(Winter_Machine * wm);
+// Something that started at start and ends now
+void trace_span(Winter_Machine * wm, const char * name, const char * category, double start);
+void trace_gc(Winter_Machine * wm, double start, size_t freed);
+
+// :\ Trace
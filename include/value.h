@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+#include <string.h>
+
 #include "error.h"
 
 typedef size_t Builtin;
@@ -20,14 +23,33 @@ typedef enum {
 	VALUE_LIST,
 	VALUE_DICTIONARY,
 	VALUE_RECORD,
+	VALUE_ISOLATE,
+	VALUE_CHANNEL,
+	VALUE_GENERATOR,
+	VALUE_VECTOR,
+	VALUE_MAP,
 } Value_Type;
 
 extern const char * value_type_names[];
 
 typedef struct Value Value;
 
+// Strings never change once made. Up to SHORT_STRING_MAX characters
+// sit in the Value itself, terminator and all, so short strings are
+// never allocated (see value_string_chars). Longer ones are a heap
+// object whose characters are in a malloc'd buffer that any number of
+// strings, in any number of machines, share; copying a string never
+// copies its characters. The hash is computed the first time it's
+// asked for (see value_string_hash).
+#define SHORT_STRING_MAX 6
+
 typedef struct {
-	size_t size;
+	uint32_t size;
+	// Zero until worked out
+	uint32_t hash;
+	// A symbol, made by value_new_constant_string rather than in a
+	// heap. Symbols are never short, so their characters never move.
+	bool constant;
 	char * contents;
 } Winter_String;
 
@@ -37,46 +59,147 @@ typedef struct {
 	Value * contents;
 } Winter_List;
 
-// TODO(pixlark): This should be a real hash table, right now it's
-// just two VALUE_LISTs strung together.
+typedef struct Winter_Dict_Entry Winter_Dict_Entry;
+typedef struct Dict_Shape Dict_Shape;
+
+// Dictionaries start out shaped: while every key is a string, added
+// in order and never removed, the keys are described by a shared
+// shape (see shape.h) and the values sit in a malloc'd slot array.
+// Any other key, a removal, or too many keys turns the dictionary
+// hashed for good.
+//
+// Hashed dictionaries use a compact layout: entries sit densely in
+// insertion order, and an open addressing hash table of positions in
+// them does the lookups. Both live in one malloc'd block, the table
+// first. Entries are only appended, so there are as many deleted
+// entries as tombstones in the table, and both go when it's rebuilt.
+//
+// The dictionary's finalizer frees whichever it has.
 typedef struct {
-	size_t size;
-	Value * keys;   // VALUE_LIST
-	Value * values; // VALUE_LIST
+	size_t size;       // Live entries
+	// Shaped
+	Dict_Shape * shape; // NULL once hashed
+	Value * shape_values;
+	// Hashed
+	size_t used;       // Entries including deleted ones
+	size_t slot_count; // Power of two, or zero until the first insert
+	int32_t * slots;
+	Winter_Dict_Entry * entries;
 } Winter_Dictionary;
 
-typedef struct Winter_Canon Winter_Canon;
+// Persistent collections (see persistent.h), which share their nodes
+// with the collections they were made from
+typedef struct Vector_Node Vector_Node;
+typedef struct Map_Node Map_Node;
 
 typedef struct {
-	Value_Type type;
-	Winter_Canon * canon;
-} Winter_Type;
+	size_t count;
+	// VECTOR_BITS for each level of branches above the leaves
+	int shift;
+	Vector_Node * root; // NULL when empty
+} Winter_Vector;
+
+typedef struct {
+	size_t count;
+	Map_Node * root; // NULL when empty
+} Winter_Map;
+
+typedef struct Winter_Canon Winter_Canon;
 
 typedef struct Winter_Record Winter_Record;
 
+// Isolates and channels are shared between machines, so they live
+// outside of any heap (see isolate.h)
+typedef struct Winter_Isolate Winter_Isolate;
+typedef struct Winter_Channel Winter_Channel;
+
+typedef struct Winter_Generator Winter_Generator;
+
+// One word, with the type in the top byte. Integers, floats, bools and
+// builtins are immediate, in the low four bytes. Everything else is a
+// pointer in the low six, which is every bit user space addresses use
+// on x86-64 and AArch64; the accessors below get them back out. A type
+// keeps the type it stands for in the byte in between, and its canon,
+// if it's a record type, in the pointer. A short string has its
+// characters in the first seven bytes instead, and the top bit set.
 struct Value {
-	Value_Type type;
 	union {
-		Winter_Type _type;
+		struct {
+			uint64_t _pointer : 48;
+			Value_Type _type : 8;
+			Value_Type type : 7;
+			bool _short : 1;
+		};
 		int _integer;
 		float _float;
 		bool _bool;
-		Winter_String _string;
-		Function * _function;
-		Builtin _builtin;
-		Winter_List * _list;
-		Winter_Dictionary * _dictionary;
-		Winter_Record * _record;
+		uint32_t _builtin;
 	};
 };
 
+_Static_assert(sizeof(Value) == 8, "Value should be one word");
+
+// Macros rather than functions, since the default build doesn't inline
+#define value_pointer(value)    ((void*) (uintptr_t) (value)._pointer)
+#define value_string(value)     ((Winter_String*) value_pointer(value))
+#define value_function(value)   ((Function*) value_pointer(value))
+#define value_list(value)       ((Winter_List*) value_pointer(value))
+#define value_dictionary(value) ((Winter_Dictionary*) value_pointer(value))
+#define value_record(value)     ((Winter_Record*) value_pointer(value))
+#define value_isolate(value)    ((Winter_Isolate*) value_pointer(value))
+#define value_channel(value)    ((Winter_Channel*) value_pointer(value))
+#define value_generator(value)  ((Winter_Generator*) value_pointer(value))
+#define value_vector(value)     ((Winter_Vector*) value_pointer(value))
+#define value_map(value)        ((Winter_Map*) value_pointer(value))
+// NULL unless it's a record type
+#define value_canon(value)      ((Winter_Canon*) value_pointer(value))
+
+// value_string is only for strings that aren't short. These work for
+// any string, and need somewhere the value stays put while the
+// characters are in use.
+#define value_string_chars(value_ptr) \
+	((value_ptr)->_short ? (char*) (value_ptr) : value_string(*(value_ptr))->contents)
+#define value_string_size(value) \
+	((value)._short ? strlen((char*) &(value)) : value_string(value)->size)
+// A symbol (see value_new_constant_string)
+#define value_string_constant(value) \
+	(!(value)._short && value_string(value)->constant)
+
+struct Winter_Dict_Entry {
+	Value key;
+	Value value;
+	uint32_t hash;
+	// Removed entries stay until the next rebuild, as none -> none
+	bool deleted;
+};
+
+// Fields are stored in place, in the order the canon lists their
+// names, so a record is a single allocation
 struct Winter_Record {
 	Winter_Canon * canon;
-	Value field_dict;
+	Value fields[];
 };
 
 struct Winter_Canon {
 	Value fields;
+	// Unique to each record declaration executed, and kept by copies
+	// in other machines, since they lay their fields out the same.
+	// Field inline caches key on it rather than on the pointer, which
+	// a later canon can be allocated at.
+	uint64_t id;
+};
+
+typedef struct Call_Frame Call_Frame;
+
+// The suspended call of a generator function. The frame holds a
+// reference to each of its variables for as long as it's alive, the
+// same as a frame on the call stack, and is released when the
+// generator finishes or is collected. While running, the frame is on
+// the call stack instead.
+struct Winter_Generator {
+	Call_Frame * frame;
+	bool running;
+	bool done;
 };
 
 // :\ Value
@@ -88,11 +211,21 @@ Value value_new_integer(int i);
 Value value_new_float(float f);
 Value value_new_bool(bool b);
 Value value_new_string(const char * s);
+// Outside of any heap and never freed, for strings the compiler or
+// runtime makes once and every machine shares. Never short. Refcount changes and
+// deep copies leave them alone. Only symbol_intern makes these, so
+// that no two have the same characters.
+Value value_new_constant_string(const char * s);
 Value value_new_function(BC_Chunk * bytecode);
+// For the types whose values are a pointer to something
+Value value_new_pointer(Value_Type type, void * pointer);
 Value value_new_builtin(Builtin b);
 Value value_new_list();
 Value value_new_dictionary();
+Winter_Canon * value_new_canon(Value fields);
 Value value_new_record(Winter_Canon * canon);
+Value value_new_record_type(Winter_Canon * canon);
+Value value_new_generator(Call_Frame * frame);
 // :\ Value creation
 
 // : Value operations
@@ -109,6 +242,10 @@ Value value_equal(Value a, Value b, Assoc_Source assoc);
 Value value_greater_than(Value a, Value b, Assoc_Source assoc);
 Value value_less_than(Value a, Value b, Assoc_Source assoc);
 Value value_cast(Value a, Value_Type type, Assoc_Source assoc);
+// Equality of two values of the same type, and a hash consistent with
+// it for the types that can be keys
+bool value_internal_equal(Value a, Value b);
+uint32_t value_hash(Value value);
 // :\ Value operations
 
 // : List operations
@@ -119,12 +256,39 @@ Value value_index(Value collection, Value index, Assoc_Source assoc);
 Value value_pop_list(Value value);
 // :\ List operations
 
+// : Record operations
+// Position of the named field in records of the canon, or -1
+int value_record_field_index(Winter_Canon * canon, const char * name);
+// :\ Record operations
+
 // : Dictionary operations
 Value * value_index_dictionary(Value collection, Value key);
+// Replaces the value if the key is already there
 void value_add_pair_dictionary(Value dict, Value key, Value value);
+// Returns false if the key isn't there
+bool value_remove_dictionary(Value dict, Value key, Value * removed);
+// Positions 0 up to dictionary_end hold the entries in insertion
+// order, with a NULL value for ones that were removed. Keys of shaped
+// dictionaries are made into strings as they're asked for.
+size_t dictionary_end(Winter_Dictionary * dict);
+Value * dictionary_value(Winter_Dictionary * dict, size_t i);
+Value dictionary_key(Winter_Dictionary * dict, size_t i);
 void value_add_pair(Value dict, Value key, Value value, Assoc_Source assoc);
 // :\ Dictionary operations
 
+// : String operations
+uint32_t value_hash_chars(const char * chars, size_t size);
+uint32_t value_string_hash(Winter_String * string);
+// :\ String operations
+
 // : Value GC
 void value_modify_refcount(Value value, int change);
+// How many references a list, dictionary or record has. Counts are
+// deep, so each of those is also a reference to everything inside it,
+// and a value moving in or out has to change by this much.
+int32_t value_holders(Value collection);
 // :\ Value GC
+
+// : Value copying
+Value value_deep_copy(Value value);
+// :\ Value copying
@@ -1,13 +1,17 @@
 #pragma once
 
+#include <stdatomic.h>
+
 #include "common.h"
 #include "gc.h"
 #include "builtin.h"
+#include "reactor.h"
 #include "value.h"
 
 // : Variable_Map
 
-// Maps variable names to pointers to values in memory.
+// Maps variable names to pointers to values in memory. Names are
+// symbols (see symbol.h) and are compared by address.
 
 typedef struct {
 	size_t size;
@@ -16,6 +20,7 @@ typedef struct {
 } Variable_Map;
 
 Variable_Map variable_map_new();
+Variable_Map variable_map_copy(Variable_Map map);
 Value * variable_map_index(Variable_Map * map, const char * name);
 Value * variable_map_update(Variable_Map * map, const char * name, Value value);
 
@@ -54,19 +59,49 @@ typedef struct {
 	int end_offset;
 } Instr_Set_Loop;
 
+typedef struct {
+	const char * name;
+} Instr_For_Iter;
+
 typedef struct {
 	size_t parameter_count;
 	BC_Chunk * bytecode;	
+	// Contains a yield, so calls return a generator
+	bool generator;
+	const char * name;
 } Instr_Create_Function;
 
 typedef struct {
-	const char * literal;
+	// A constant string, made along with the chunk
+	Value string;
 } Instr_Create_String;
 
 typedef struct {
 	size_t field_count;
 } Instr_Create_Type_Canon;
 
+// Which slot the field was in for the last few canons a field access
+// saw, or the key for the last few dictionary shapes. Each entry packs
+// a canon or shape id and slot into one word, so machines on other
+// threads running the same bytecode can fill and read it without ever
+// seeing half an entry. Zero is empty.
+#define FIELD_CACHE_SIZE 4
+#define FIELD_CACHE_SLOT_BITS 16
+
+typedef struct {
+	_Atomic uint64_t entries[FIELD_CACHE_SIZE];
+} Field_Cache;
+
+// GET_FIELD and ASSIGN_FIELD, and INDEX_KEY and ASSIGN_KEY for
+// indexing by a string literal
+typedef struct {
+	const char * name;
+	// The name's symbol, a ready-made key for dictionaries without a
+	// shape
+	Value key;
+	Field_Cache * cache;
+} Instr_Field;
+
 enum Instruction {
 	// No args
 	INSTR_NOP,
@@ -81,8 +116,7 @@ enum Instruction {
 	INSTR_BIND,
 	INSTR_INDEX_ASSIGN,
 	INSTR_ADD_PAIR,
-	INSTR_GET_FIELD,
-	INSTR_ASSIGN_FIELD,
+	INSTR_YIELD,
 	// Operations
 	INSTR_NEGATE,
 	INSTR_ADD,
@@ -102,14 +136,24 @@ enum Instruction {
 	INSTR_JUMP,
 	INSTR_CONDJUMP,
 	INSTR_SET_LOOP,
+	INSTR_SET_ITER,
+	INSTR_SET_RANGE,
+	INSTR_FOR_ITER,
+	INSTR_GET_FIELD,
+	INSTR_ASSIGN_FIELD,
+	INSTR_INDEX_KEY,
+	INSTR_ASSIGN_KEY,
 	// Creation of dynamically allocated values
 	INSTR_CREATE_FUNCTION,
 	INSTR_CREATE_LIST,
 	INSTR_CREATE_STRING,
 	INSTR_CREATE_DICTIONARY,
 	INSTR_CREATE_TYPE_CANON,
+	NUM_INSTRUCTIONS,
 };
 
+extern const char * instr_names[NUM_INSTRUCTIONS];
+
 // :\ Instruction
 
 // : BC_Chunk
@@ -124,7 +168,9 @@ struct BC_Chunk {
 		Instr_Call instr_call;
 		Instr_Jump instr_jump;
 		Instr_Condjump instr_condjump;
-		Instr_Set_Loop instr_set_loop;
+		Instr_Set_Loop instr_set_loop; // Also SET_ITER and SET_RANGE
+		Instr_For_Iter instr_for_iter;
+		Instr_Field instr_field; // GET_FIELD, ASSIGN_FIELD, INDEX_KEY and ASSIGN_KEY
 		Instr_Create_Function instr_create_function;
 		Instr_Create_String instr_create_string;
 		Instr_Create_Type_Canon instr_create_type_canon;
@@ -139,7 +185,21 @@ BC_Chunk bc_chunk_new_call(size_t arg_count);
 BC_Chunk bc_chunk_new_jump(int offset);
 BC_Chunk bc_chunk_new_condjump(int offset, bool cond);
 BC_Chunk bc_chunk_new_set_loop(size_t end_offset);
-BC_Chunk bc_chunk_new_create_function(size_t parameter_count, BC_Chunk * bytecode);
+BC_Chunk bc_chunk_new_set_iter(size_t end_offset);
+BC_Chunk bc_chunk_new_set_range(size_t end_offset);
+BC_Chunk bc_chunk_new_for_iter(const char * name);
+// instr is GET_FIELD, ASSIGN_FIELD, INDEX_KEY or ASSIGN_KEY
+BC_Chunk bc_chunk_new_field(enum Instruction instr, const char * name);
+// Frees a top-level unit once it has run, along with the field caches
+// its own chunks own. Function bodies it created are left alone, since
+// the functions still point into them.
+void bc_unit_free(BC_Chunk * bytecode);
+// Collects the names bytecode looks up, including in the bodies of
+// functions it creates, into the sb names, each once. A closure only
+// ever gets read through these.
+void bytecode_referenced_names(BC_Chunk * bytecode, const char *** names);
+BC_Chunk bc_chunk_new_create_function(size_t parameter_count, BC_Chunk * bytecode,
+									  bool generator, const char * name);
 BC_Chunk bc_chunk_new_create_string(const char * literal);
 BC_Chunk bc_chunk_new_create_type_canon(size_t field_count);
 
@@ -153,38 +213,119 @@ void bc_chunk_print(BC_Chunk chunk);
 // stack, containing a Variable_Map for every variable that gets used
 // in that function.
 
+typedef enum {
+	LOOP_PLAIN,
+	LOOP_RANGE,
+	LOOP_LIST,
+	LOOP_DICTIONARY,
+	LOOP_VECTOR,
+} Loop_Kind;
+
+// for loops carry their iteration state here, so FOR_ITER can step
+// without touching the eval stack. Ranges count with a plain int;
+// lists and dictionaries (by key) hold a reference to the collection
+// and an index into it.
 typedef struct {
 	size_t start;
 	size_t end;
+	Loop_Kind kind;
+	int64_t counter;
+	int64_t stop;
+	int64_t step;
+	Value collection;
+	// The loop variable, found on the first iteration
+	Value * var;
 } Loop;
 
-typedef struct {
+typedef struct Call_Frame {
 	Variable_Map var_map;
 	BC_Chunk * bytecode;
 	size_t ip;
 	Loop * loop_stack;
+	// Set for the frame of a generator, which outlives its calls
+	Winter_Generator * generator;
+	// Of the function running in the frame; NULL for base frames
+	const char * name;
 } Call_Frame;
 
 Call_Frame * call_frame_alloc(BC_Chunk * bytecode);
+void call_frame_free(Call_Frame * frame);
+// Drops the references the frame holds, for when it's done running
+void call_frame_release(Call_Frame * frame);
 
 // :\ Call_Frame
 
+// : Fiber
+
+// A green thread within a machine. Fibers are scheduled cooperatively:
+// the running fiber keeps going until it calls yield_fiber(), blocks
+// (e.g. receiving on an empty channel) or finishes. The main program
+// is a fiber too, the one without bytecode of its own.
+
+typedef struct Fiber {
+	Call_Frame ** call_stack;
+	Value * eval_stack;
+	// [CALL n, POP] for the base frame, with the function and its
+	// arguments already pushed
+	BC_Chunk * bytecode;
+} Fiber;
+
+// :\ Fiber
+
 // : Winter_Machine
 
 // The central virtual machine that runs Winter bytecode
 
-typedef struct {
+// Every machine owns the heap its values live in, so any number of
+// machines can exist in one process, each driven by one thread at a
+// time.
+
+typedef struct Winter_Machine {
+	// Stacks of the running fiber
 	Call_Frame ** call_stack;
 	Value * eval_stack;
+	Call_Frame * global_frame;
 	
 	bool running;
 
+	// Fibers waiting for their turn, oldest first from fiber_head
+	Fiber ** fibers;
+	size_t fiber_head;
+	Fiber * fiber;
+	Fiber * main_fiber;
+	// Set during a step to switch fibers once it's done
+	bool switch_fiber;
+	// Set by a builtin that can't proceed yet; the call is retried
+	// on the fiber's next turn
+	bool blocked;
+	// If the builtin is waiting on an fd, the fiber sleeps in the
+	// reactor until it's ready instead of going back in the queue
+	int wait_fd;
+	uint32_t wait_events;
+	Reactor reactor;
+
+	GC gc;
 	size_t cycles_since_collection;
+
+	// Counts every instruction executed, for --opstats; NULL when off
+	struct Op_Stats * op_stats;
 } Winter_Machine;
 
 Winter_Machine * winter_machine_alloc();
+void winter_machine_free(Winter_Machine * wm);
 void winter_machine_step(Winter_Machine * wm);
 void winter_machine_prime(Winter_Machine * wm, BC_Chunk * bytecode);
+Call_Frame * winter_machine_global_frame(Winter_Machine * wm);
+Value winter_machine_call(Winter_Machine * wm, Value func,
+						  Value * args, size_t arg_count, Assoc_Source assoc);
+// Number of fibers besides the running one, ready to run or not
+size_t winter_machine_waiting_fibers(Winter_Machine * wm);
+// For builtins: block until fd is ready for events, then retry
+void winter_machine_wait_fd(Winter_Machine * wm, int fd, uint32_t events);
+void winter_machine_go(Winter_Machine * wm, Value func,
+					   Value * args, size_t arg_count, Assoc_Source assoc);
+// Runs fibers until they've all finished; main has to be idle
+void winter_machine_join_fibers(Winter_Machine * wm);
 void winter_machine_garbage_collect(Winter_Machine * wm); // Defined in gc.c... should it be?
 
 // :\ Winter_Machine
@@ -196,6 +337,11 @@ typedef struct Function {
 	Value parameter_list;
 	Variable_Map closure;
 	BC_Chunk * bytecode;
+	// Declared pure with pure(), so parallel builtins take it on trust
+	bool pure;
+	bool generator;
+	// As declared, for profiles and traces
+	const char * name;
 } Function;
 
 // :\ Function
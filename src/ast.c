@@ -76,6 +76,9 @@ void deep_free(Stmt * stmt)
 	case STMT_RETURN:
 		deep_free_expr(stmt->_return.expr);
 		break;
+	case STMT_YIELD:
+		deep_free_expr(stmt->_yield.expr);
+		break;
 	case STMT_IF:
 		// Free conditions
 		for (int i = 0; i < sb_count(stmt->_if.conditions); i++) {
@@ -97,6 +100,10 @@ void deep_free(Stmt * stmt)
 		deep_free_expr(stmt->_while.condition);
 		deep_free_body(stmt->_while.body);
 		break;
+	case STMT_FOR:
+		deep_free_expr(stmt->_for.iterable);
+		deep_free_body(stmt->_for.body);
+		break;
 	case STMT_BREAK:
 	case STMT_CONTINUE:
 		break;
@@ -0,0 +1,354 @@
+#include "bc_cache.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// : BC_Cache
+
+// File layout (all integers are fixed-width, host byte order):
+//
+//   "WBC\0" | u32 version | u64 source hash | u32 unit count | units...
+//
+// A unit is a u32 chunk count followed by that many chunks. Every
+// chunk starts with its instruction and Assoc_Source, then whatever
+// arguments the instruction carries. Strings are a u32 length and
+// their bytes including the terminating NUL, so they can be used in
+// place. Function bodies are nested units.
+
+#define BC_CACHE_MAGIC "WBC"
+#define BC_CACHE_VERSION 6
+
+uint64_t bc_cache_hash_source(const char * source)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char * p = source; *p; p++) {
+		hash ^= (uint8_t) *p;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// : Writing
+
+static void write_u32(FILE * file, uint32_t u)
+{
+	fwrite(&u, sizeof(u), 1, file);
+}
+
+static void write_string(FILE * file, const char * s)
+{
+	uint32_t len = strlen(s);
+	write_u32(file, len);
+	fwrite(s, 1, len + 1, file);
+}
+
+static void write_value(FILE * file, Value value)
+{
+	write_u32(file, value.type);
+	switch (value.type) {
+	case VALUE_NONE:
+		break;
+	case VALUE_TYPE:
+		// Record canons only exist at runtime
+		internal_assert(value_canon(value) == NULL);
+		write_u32(file, value._type);
+		break;
+	case VALUE_INTEGER:
+		write_u32(file, (uint32_t) value._integer);
+		break;
+	case VALUE_FLOAT: {
+		uint32_t bits;
+		memcpy(&bits, &value._float, sizeof(bits));
+		write_u32(file, bits);
+	} break;
+	case VALUE_BOOL:
+		write_u32(file, value._bool);
+		break;
+	case VALUE_BUILTIN:
+		write_u32(file, value._builtin);
+		break;
+	default:
+		fatal_internal("Value of type %s can't be written to a bytecode cache",
+					   value_type_names[value.type]);
+	}
+}
+
+static void write_unit(FILE * file, BC_Chunk * bytecode)
+{
+	write_u32(file, sb_count(bytecode));
+	for (int i = 0; i < sb_count(bytecode); i++) {
+		BC_Chunk chunk = bytecode[i];
+		write_u32(file, chunk.instr);
+		write_u32(file, chunk.assoc.line);
+		write_u32(file, chunk.assoc.position);
+		write_u32(file, chunk.assoc.len);
+		write_u32(file, chunk.assoc.eof);
+		switch (chunk.instr) {
+		case INSTR_PUSH:
+			write_value(file, chunk.instr_push.value);
+			break;
+		case INSTR_GET:
+			write_string(file, chunk.instr_get.name);
+			break;
+		case INSTR_CALL:
+			write_u32(file, chunk.instr_call.arg_count);
+			break;
+		case INSTR_JUMP:
+			write_u32(file, (uint32_t) chunk.instr_jump.jump_offset);
+			break;
+		case INSTR_CONDJUMP:
+			write_u32(file, (uint32_t) chunk.instr_condjump.jump_offset);
+			write_u32(file, chunk.instr_condjump.cond);
+			break;
+		case INSTR_SET_LOOP:
+		case INSTR_SET_ITER:
+		case INSTR_SET_RANGE:
+			write_u32(file, (uint32_t) chunk.instr_set_loop.end_offset);
+			break;
+		case INSTR_FOR_ITER:
+			write_string(file, chunk.instr_for_iter.name);
+			break;
+		case INSTR_GET_FIELD:
+		case INSTR_ASSIGN_FIELD:
+		case INSTR_INDEX_KEY:
+		case INSTR_ASSIGN_KEY:
+			write_string(file, chunk.instr_field.name);
+			break;
+		case INSTR_CREATE_FUNCTION:
+			write_u32(file, chunk.instr_create_function.parameter_count);
+			write_u32(file, chunk.instr_create_function.generator);
+			write_string(file, chunk.instr_create_function.name);
+			write_unit(file, chunk.instr_create_function.bytecode);
+			break;
+		case INSTR_CREATE_STRING:
+			write_string(file, value_string(chunk.instr_create_string.string)->contents);
+			break;
+		case INSTR_CREATE_TYPE_CANON:
+			write_u32(file, chunk.instr_create_type_canon.field_count);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+void bc_cache_write(const char * path, uint64_t source_hash, BC_Chunk ** units)
+{
+	char tmp_path[1024];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int) getpid());
+	FILE * file = fopen(tmp_path, "wb");
+	if (!file) return;
+
+	fwrite(BC_CACHE_MAGIC, 1, 4, file);
+	write_u32(file, BC_CACHE_VERSION);
+	fwrite(&source_hash, sizeof(source_hash), 1, file);
+	write_u32(file, sb_count(units));
+	for (int i = 0; i < sb_count(units); i++) {
+		write_unit(file, units[i]);
+	}
+
+	bool failed = ferror(file);
+	if (fclose(file) != 0 || failed || rename(tmp_path, path) != 0) {
+		remove(tmp_path);
+	}
+}
+
+// :\ Writing
+
+// : Reading
+
+// Any malformed input just marks the reader as failed; the caller
+// throws the partial result away and falls back to compiling.
+
+typedef struct {
+	const uint8_t * cursor;
+	const uint8_t * end;
+	Lexer * lexer;
+	bool failed;
+} BC_Reader;
+
+static bool reader_has(BC_Reader * reader, size_t size)
+{
+	if (reader->failed || (size_t) (reader->end - reader->cursor) < size) {
+		reader->failed = true;
+		return false;
+	}
+	return true;
+}
+
+static uint32_t read_u32(BC_Reader * reader)
+{
+	uint32_t u = 0;
+	if (reader_has(reader, sizeof(u))) {
+		memcpy(&u, reader->cursor, sizeof(u));
+		reader->cursor += sizeof(u);
+	}
+	return u;
+}
+
+static const char * read_string(BC_Reader * reader)
+{
+	uint32_t len = read_u32(reader);
+	if (!reader_has(reader, (size_t) len + 1)) return "";
+	const char * s = (const char *) reader->cursor;
+	if (s[len] != '\0') {
+		reader->failed = true;
+		return "";
+	}
+	reader->cursor += len + 1;
+	return s;
+}
+
+static Value read_value(BC_Reader * reader)
+{
+	Value_Type type = read_u32(reader);
+	switch (type) {
+	case VALUE_NONE:
+		return value_none();
+	case VALUE_TYPE:
+		return value_new_type(read_u32(reader));
+	case VALUE_INTEGER:
+		return value_new_integer((int32_t) read_u32(reader));
+	case VALUE_FLOAT: {
+		uint32_t bits = read_u32(reader);
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+		return value_new_float(f);
+	} break;
+	case VALUE_BOOL:
+		return value_new_bool(read_u32(reader));
+	case VALUE_BUILTIN: {
+		Builtin builtin = read_u32(reader);
+		if (builtin >= NUM_BUILTINS) reader->failed = true;
+		return value_new_builtin(builtin);
+	} break;
+	default:
+		reader->failed = true;
+		return value_none();
+	}
+}
+
+static BC_Chunk * read_unit(BC_Reader * reader)
+{
+	uint32_t count = read_u32(reader);
+	// Every chunk takes at least its five header words
+	if (!reader_has(reader, (size_t) count * 5 * sizeof(uint32_t))) return NULL;
+	BC_Chunk * bytecode = NULL;
+	for (uint32_t i = 0; i < count && !reader->failed; i++) {
+		BC_Chunk chunk = bc_chunk_new_no_args(read_u32(reader));
+		chunk.assoc.lexer    = reader->lexer;
+		chunk.assoc.line     = read_u32(reader);
+		chunk.assoc.position = read_u32(reader);
+		chunk.assoc.len      = read_u32(reader);
+		chunk.assoc.eof      = read_u32(reader);
+		switch (chunk.instr) {
+		case INSTR_PUSH:
+			chunk.instr_push.value = read_value(reader);
+			break;
+		case INSTR_GET:
+			chunk.instr_get = bc_chunk_new_get(read_string(reader)).instr_get;
+			break;
+		case INSTR_CALL:
+			chunk.instr_call.arg_count = read_u32(reader);
+			break;
+		case INSTR_JUMP:
+			chunk.instr_jump.jump_offset = (int32_t) read_u32(reader);
+			break;
+		case INSTR_CONDJUMP:
+			chunk.instr_condjump.jump_offset = (int32_t) read_u32(reader);
+			chunk.instr_condjump.cond = read_u32(reader);
+			break;
+		case INSTR_SET_LOOP:
+		case INSTR_SET_ITER:
+		case INSTR_SET_RANGE:
+			chunk.instr_set_loop.end_offset = (int32_t) read_u32(reader);
+			break;
+		case INSTR_FOR_ITER:
+			chunk.instr_for_iter = bc_chunk_new_for_iter(read_string(reader)).instr_for_iter;
+			break;
+		case INSTR_GET_FIELD:
+		case INSTR_ASSIGN_FIELD:
+		case INSTR_INDEX_KEY:
+		case INSTR_ASSIGN_KEY:
+			chunk.instr_field = bc_chunk_new_field(chunk.instr, read_string(reader)).instr_field;
+			break;
+		case INSTR_CREATE_FUNCTION:
+			chunk.instr_create_function.parameter_count = read_u32(reader);
+			chunk.instr_create_function.generator = read_u32(reader);
+			chunk.instr_create_function.name = read_string(reader);
+			chunk.instr_create_function.bytecode = read_unit(reader);
+			break;
+		case INSTR_CREATE_STRING:
+			chunk.instr_create_string = bc_chunk_new_create_string(read_string(reader)).instr_create_string;
+			break;
+		case INSTR_CREATE_TYPE_CANON:
+			chunk.instr_create_type_canon.field_count = read_u32(reader);
+			break;
+		default:
+			if (chunk.instr >= NUM_INSTRUCTIONS) reader->failed = true;
+			break;
+		}
+		sb_push(bytecode, chunk);
+	}
+	return bytecode;
+}
+
+BC_Chunk ** bc_cache_load(const char * path, uint64_t source_hash, Lexer * lexer)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	void * mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return NULL;
+
+	BC_Reader reader = (BC_Reader) {
+		.cursor = mapping,
+		.end = (const uint8_t *) mapping + st.st_size,
+		.lexer = lexer,
+		.failed = false,
+	};
+
+	// Header
+	uint64_t hash = 0;
+	if (reader_has(&reader, 4) && memcmp(reader.cursor, BC_CACHE_MAGIC, 4) == 0) {
+		reader.cursor += 4;
+	} else {
+		reader.failed = true;
+	}
+	if (read_u32(&reader) != BC_CACHE_VERSION) reader.failed = true;
+	if (reader_has(&reader, sizeof(hash))) {
+		memcpy(&hash, reader.cursor, sizeof(hash));
+		reader.cursor += sizeof(hash);
+	}
+	if (hash != source_hash) reader.failed = true;
+
+	// Units
+	BC_Chunk ** units = NULL;
+	uint32_t unit_count = read_u32(&reader);
+	for (uint32_t i = 0; i < unit_count && !reader.failed; i++) {
+		sb_push(units, read_unit(&reader));
+	}
+
+	if (reader.failed) {
+		// Bytecode already built is unreferenced and small, and the
+		// strings in it may point into the mapping, so don't bother
+		// picking it apart
+		sb_free(units);
+		munmap(mapping, st.st_size);
+		return NULL;
+	}
+	return units;
+}
+
+// :\ Reading
+
+// :\ BC_Cache
@@ -1,6 +1,20 @@
+// For pipe2 and accept4
+#define _GNU_SOURCE
+
 #include "builtin.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 #include "common.h"
+#include "isolate.h"
+#include "parallel.h"
+#include "persistent.h"
 
 const char * builtin_names[] = {
 	"print",
@@ -10,6 +24,37 @@ const char * builtin_names[] = {
 	"list_append",
 	"list_pop",
 	"list_count",
+	"spawn",
+	"join",
+	"channel",
+	"send",
+	"receive",
+	"par_map",
+	"par_filter",
+	"par_reduce",
+	"pure",
+	"next",
+	"done",
+	"go",
+	"yield_fiber",
+	"fd_open",
+	"fd_read",
+	"fd_write",
+	"fd_close",
+	"fd_pipe",
+	"unix_listen",
+	"unix_accept",
+	"unix_connect",
+	"range",
+	"dict_remove",
+	"vector",
+	"vector_append",
+	"vector_set",
+	"vector_count",
+	"map",
+	"map_set",
+	"map_remove",
+	"map_count",
 };
 
 // -1 means varargs
@@ -21,9 +66,126 @@ int builtin_arg_counts[] = {
 	2,
 	1,
 	1,
+	-1,
+	1,
+	0,
+	2,
+	1,
+	2,
+	2,
+	3,
+	1,
+	1,
+	1,
+	-1,
+	0,
+	2,
+	2,
+	2,
+	1,
+	0,
+	1,
+	1,
+	1,
+	-1,
+	2,
+	-1,
+	2,
+	3,
+	1,
+	-1,
+	3,
+	2,
+	1,
 };
 
-#define DEFINE_BUILTIN(name) Value name (Value * args, size_t arg_count, Assoc_Source assoc)
+// Whether calling the builtin is free of side effects, for the
+// parallel builtins' purity check
+bool builtin_purity[] = {
+	false,
+	false,
+	true,
+	true,
+	false,
+	false,
+	true,
+	false,
+	false,
+	false,
+	false,
+	false,
+	true,
+	true,
+	true,
+	true,
+	false,
+	true,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	true,
+	false,
+	true,
+	true,
+	true,
+	true,
+	true,
+	true,
+	true,
+	true,
+};
+
+// Whether the builtin can wait on something outside the machine
+// (input, other threads, the network), for --trace
+bool builtin_blocking[] = {
+	false,
+	true,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	true,
+	false,
+	false,
+	true,
+	true,
+	true,
+	true,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	true,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+	false,
+};
+
+#define DEFINE_BUILTIN(name) Value name (Winter_Machine * wm, Value * args, size_t arg_count, Assoc_Source assoc)
 
 DEFINE_BUILTIN(builtin_print)
 {
@@ -32,9 +194,9 @@ DEFINE_BUILTIN(builtin_print)
 		Value to_print = value_cast(args[i], VALUE_STRING, assoc);
 		internal_assert(to_print.type == VALUE_STRING);
 		if (i != arg_count - 1) {
-			printf("%s ", to_print._string.contents);
+			printf("%s ", value_string_chars(&to_print));
 		} else {
-			printf("%s", to_print._string.contents);
+			printf("%s", value_string_chars(&to_print));
 		}
 	}
 	printf("\n");
@@ -48,7 +210,7 @@ DEFINE_BUILTIN(builtin_read_input)
 	if (prompt_val.type != VALUE_STRING) {
 		fatal_assoc(assoc, "read_input requires a string");
 	}
-	const char * prompt = prompt_val._string.contents;
+	const char * prompt = value_string_chars(&prompt_val);
 	printf("%s", prompt);
 	// TODO(pixlark): Limits input size
 	char buffer[1024];
@@ -85,7 +247,7 @@ DEFINE_BUILTIN(builtin_list_append)
 	}
 	Value to_append = args[1];
 	value_append_list(list, to_append);
-	value_modify_refcount(to_append, 1);
+	value_modify_refcount(to_append, value_holders(list));
 	return value_none();
 }
 
@@ -103,10 +265,416 @@ DEFINE_BUILTIN(builtin_list_count)
 {
 	Value list = args[0];
 	internal_assert(list.type == VALUE_LIST);
-	return value_new_integer(list._list->size);
+	return value_new_integer(value_list(list)->size);
 }
 
-Value (*builtin_functions[])(Value*, size_t, Assoc_Source) = {
+// for loops over a literal range() call never get here; the compiler
+// turns those into a counting loop. This is for using a range as a
+// list.
+DEFINE_BUILTIN(builtin_range)
+{
+	if (arg_count < 1 || arg_count > 3) {
+		fatal_assoc(assoc, "range takes one to three arguments");
+	}
+	for (int i = 0; i < arg_count; i++) {
+		if (args[i].type != VALUE_INTEGER) {
+			fatal_assoc(assoc, "range requires integers");
+		}
+	}
+	int start = arg_count == 1 ? 0 : args[0]._integer;
+	int stop  = arg_count == 1 ? args[0]._integer : args[1]._integer;
+	int step  = arg_count == 3 ? args[2]._integer : 1;
+	if (step == 0) {
+		fatal_assoc(assoc, "range step can't be zero");
+	}
+	Value list = value_new_list();
+	for (int64_t i = start; step > 0 ? i < stop : i > stop; i += step) {
+		value_append_list(list, value_new_integer(i));
+	}
+	return list;
+}
+
+DEFINE_BUILTIN(builtin_dict_remove)
+{
+	Value dict = args[0];
+	if (dict.type != VALUE_DICTIONARY) {
+		fatal_assoc(assoc, "dict_remove requires a dictionary");
+	}
+	Value removed;
+	if (!value_remove_dictionary(dict, args[1], &removed)) {
+		fatal_assoc(assoc, "Key not found in dictionary");
+	}
+	return removed;
+}
+
+// : Persistent collections
+
+// Each of these gives a new collection and leaves its argument alone
+
+DEFINE_BUILTIN(builtin_vector)
+{
+	if (arg_count > 1) {
+		fatal_assoc(assoc, "vector takes at most one list");
+	}
+	if (arg_count == 0) return vector_new();
+	if (args[0].type != VALUE_LIST) {
+		fatal_assoc(assoc, "vector requires a list");
+	}
+	return vector_from_list(args[0]);
+}
+
+DEFINE_BUILTIN(builtin_vector_append)
+{
+	if (args[0].type != VALUE_VECTOR) {
+		fatal_assoc(assoc, "vector_append requires a vector");
+	}
+	return vector_append(args[0], args[1]);
+}
+
+DEFINE_BUILTIN(builtin_vector_set)
+{
+	if (args[0].type != VALUE_VECTOR || args[1].type != VALUE_INTEGER) {
+		fatal_assoc(assoc, "vector_set requires a vector and an index");
+	}
+	if (!vector_index(value_vector(args[0]), args[1]._integer)) {
+		fatal_assoc(assoc, "Vector index out of bounds");
+	}
+	return vector_set(args[0], args[1]._integer, args[2]);
+}
+
+DEFINE_BUILTIN(builtin_vector_count)
+{
+	if (args[0].type != VALUE_VECTOR) {
+		fatal_assoc(assoc, "vector_count requires a vector");
+	}
+	return value_new_integer(value_vector(args[0])->count);
+}
+
+DEFINE_BUILTIN(builtin_map)
+{
+	if (arg_count > 1) {
+		fatal_assoc(assoc, "map takes at most one dictionary");
+	}
+	if (arg_count == 0) return map_new();
+	if (args[0].type != VALUE_DICTIONARY) {
+		fatal_assoc(assoc, "map requires a dictionary");
+	}
+	return map_from_dictionary(args[0]);
+}
+
+DEFINE_BUILTIN(builtin_map_set)
+{
+	if (args[0].type != VALUE_MAP) {
+		fatal_assoc(assoc, "map_set requires a map");
+	}
+	return map_set(args[0], args[1], args[2]);
+}
+
+DEFINE_BUILTIN(builtin_map_remove)
+{
+	if (args[0].type != VALUE_MAP) {
+		fatal_assoc(assoc, "map_remove requires a map");
+	}
+	Value result;
+	if (!map_remove(args[0], args[1], &result)) {
+		fatal_assoc(assoc, "Key not found in map");
+	}
+	return result;
+}
+
+DEFINE_BUILTIN(builtin_map_count)
+{
+	if (args[0].type != VALUE_MAP) {
+		fatal_assoc(assoc, "map_count requires a map");
+	}
+	return value_new_integer(value_map(args[0])->count);
+}
+
+// :\ Persistent collections
+
+DEFINE_BUILTIN(builtin_spawn)
+{
+	if (arg_count == 0) {
+		fatal_assoc(assoc, "spawn requires a function");
+	}
+	Value func = args[0];
+	if (func.type != VALUE_FUNCTION && func.type != VALUE_BUILTIN) {
+		fatal_assoc(assoc, "spawn requires a function");
+	}
+	Winter_Isolate * isolate = isolate_spawn(wm, func, args + 1, arg_count - 1, assoc);
+	return value_new_pointer(VALUE_ISOLATE, isolate);
+}
+
+DEFINE_BUILTIN(builtin_join)
+{
+	Value isolate = args[0];
+	if (isolate.type != VALUE_ISOLATE) {
+		fatal_assoc(assoc, "join requires an isolate");
+	}
+	return isolate_join(value_isolate(isolate), assoc);
+}
+
+DEFINE_BUILTIN(builtin_channel)
+{
+	return value_new_pointer(VALUE_CHANNEL, channel_alloc());
+}
+
+DEFINE_BUILTIN(builtin_send)
+{
+	Value channel = args[0];
+	if (channel.type != VALUE_CHANNEL) {
+		fatal_assoc(assoc, "send requires a channel");
+	}
+	channel_send(value_channel(channel), args[1]);
+	return value_none();
+}
+
+DEFINE_BUILTIN(builtin_receive)
+{
+	Value channel = args[0];
+	if (channel.type != VALUE_CHANNEL) {
+		fatal_assoc(assoc, "receive requires a channel");
+	}
+	if (winter_machine_waiting_fibers(wm) == 0) {
+		return channel_receive(value_channel(channel));
+	}
+	// Let the other fibers run instead of blocking the thread
+	Value value;
+	if (!channel_try_receive(value_channel(channel), &value)) {
+		winter_machine_wait_fd(wm, channel_wait_fd(value_channel(channel), assoc), EPOLLIN);
+		return value_none();
+	}
+	return value;
+}
+
+DEFINE_BUILTIN(builtin_par_map)
+{
+	return parallel_map(wm, args[0], args[1], assoc);
+}
+
+DEFINE_BUILTIN(builtin_par_filter)
+{
+	return parallel_filter(wm, args[0], args[1], assoc);
+}
+
+DEFINE_BUILTIN(builtin_par_reduce)
+{
+	return parallel_reduce(wm, args[0], args[1], args[2], assoc);
+}
+
+DEFINE_BUILTIN(builtin_pure)
+{
+	Value func = args[0];
+	if (func.type == VALUE_BUILTIN) {
+		return func;
+	}
+	if (func.type != VALUE_FUNCTION) {
+		fatal_assoc(assoc, "pure requires a function");
+	}
+	value_function(func)->pure = true;
+	return func;
+}
+
+DEFINE_BUILTIN(builtin_next)
+{
+	fatal_internal("next should have been handled by the VM");
+}
+
+DEFINE_BUILTIN(builtin_done)
+{
+	Value generator = args[0];
+	if (generator.type != VALUE_GENERATOR) {
+		fatal_assoc(assoc, "done requires a generator");
+	}
+	return value_new_bool(value_generator(generator)->done);
+}
+
+DEFINE_BUILTIN(builtin_go)
+{
+	if (arg_count == 0) {
+		fatal_assoc(assoc, "go requires a function");
+	}
+	winter_machine_go(wm, args[0], args + 1, arg_count - 1, assoc);
+	return value_none();
+}
+
+DEFINE_BUILTIN(builtin_yield_fiber)
+{
+	wm->switch_fiber = true;
+	return value_none();
+}
+
+// : I/O
+
+// Every fd is non-blocking. When an operation would block, the fiber
+// waits in the machine's reactor and the call is retried once the fd
+// is ready, so other fibers keep running. fds are plain integers.
+
+static int fd_arg(Value value, const char * name, Assoc_Source assoc)
+{
+	if (value.type != VALUE_INTEGER || value._integer < 0) {
+		fatal_assoc(assoc, "%s requires a file descriptor", name);
+	}
+	return value._integer;
+}
+
+static bool would_block()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+DEFINE_BUILTIN(builtin_fd_open)
+{
+	Value path = args[0];
+	Value mode = args[1];
+	if (path.type != VALUE_STRING || mode.type != VALUE_STRING) {
+		fatal_assoc(assoc, "fd_open requires a path and a mode");
+	}
+	int flags;
+	if (strcmp(value_string_chars(&mode), "r") == 0) {
+		flags = O_RDONLY;
+	} else if (strcmp(value_string_chars(&mode), "w") == 0) {
+		flags = O_WRONLY | O_CREAT | O_TRUNC;
+	} else if (strcmp(value_string_chars(&mode), "a") == 0) {
+		flags = O_WRONLY | O_CREAT | O_APPEND;
+	} else {
+		fatal_assoc(assoc, "fd_open mode must be \"r\", \"w\" or \"a\"");
+	}
+	int fd = open(value_string_chars(&path), flags | O_NONBLOCK | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		fatal_assoc(assoc, "Couldn't open '%s': %s", value_string_chars(&path), strerror(errno));
+	}
+	return value_new_integer(fd);
+}
+
+// Up to max bytes as a string; "" at end of file
+DEFINE_BUILTIN(builtin_fd_read)
+{
+	int fd = fd_arg(args[0], "fd_read", assoc);
+	if (args[1].type != VALUE_INTEGER || args[1]._integer <= 0) {
+		fatal_assoc(assoc, "fd_read requires a positive size");
+	}
+	size_t max = args[1]._integer;
+	char * buffer = malloc(max + 1);
+	ssize_t got = read(fd, buffer, max);
+	if (got == -1) {
+		free(buffer);
+		if (would_block()) {
+			winter_machine_wait_fd(wm, fd, EPOLLIN);
+			return value_none();
+		}
+		fatal_assoc(assoc, "Couldn't read from fd %d: %s", fd, strerror(errno));
+	}
+	buffer[got] = '\0';
+	Value ret = value_new_string(buffer);
+	free(buffer);
+	return ret;
+}
+
+// Returns how many bytes were written, which can be fewer than asked
+DEFINE_BUILTIN(builtin_fd_write)
+{
+	int fd = fd_arg(args[0], "fd_write", assoc);
+	Value data = args[1];
+	if (data.type != VALUE_STRING) {
+		fatal_assoc(assoc, "fd_write requires a string");
+	}
+	ssize_t wrote = write(fd, value_string_chars(&data), value_string_size(data));
+	if (wrote == -1) {
+		if (would_block()) {
+			winter_machine_wait_fd(wm, fd, EPOLLOUT);
+			return value_none();
+		}
+		fatal_assoc(assoc, "Couldn't write to fd %d: %s", fd, strerror(errno));
+	}
+	return value_new_integer(wrote);
+}
+
+DEFINE_BUILTIN(builtin_fd_close)
+{
+	int fd = fd_arg(args[0], "fd_close", assoc);
+	if (close(fd) == -1) {
+		fatal_assoc(assoc, "Couldn't close fd %d: %s", fd, strerror(errno));
+	}
+	return value_none();
+}
+
+// [read end, write end]
+DEFINE_BUILTIN(builtin_fd_pipe)
+{
+	int fds[2];
+	if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+		fatal_assoc(assoc, "Couldn't create pipe: %s", strerror(errno));
+	}
+	Value ends = value_new_list();
+	value_append_list(ends, value_new_integer(fds[0]));
+	value_append_list(ends, value_new_integer(fds[1]));
+	return ends;
+}
+
+static struct sockaddr_un unix_address(Value path, const char * name, Assoc_Source assoc)
+{
+	if (path.type != VALUE_STRING) {
+		fatal_assoc(assoc, "%s requires a path", name);
+	}
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (value_string_size(path) >= sizeof(address.sun_path)) {
+		fatal_assoc(assoc, "Socket path is too long");
+	}
+	strcpy(address.sun_path, value_string_chars(&path));
+	return address;
+}
+
+DEFINE_BUILTIN(builtin_unix_listen)
+{
+	struct sockaddr_un address = unix_address(args[0], "unix_listen", assoc);
+	// A socket left behind by an earlier run would make bind fail
+	struct stat st;
+	if (stat(address.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(address.sun_path);
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1 ||
+		bind(fd, (struct sockaddr*) &address, sizeof(address)) == -1 ||
+		listen(fd, SOMAXCONN) == -1) {
+		fatal_assoc(assoc, "Couldn't listen on '%s': %s", address.sun_path, strerror(errno));
+	}
+	return value_new_integer(fd);
+}
+
+DEFINE_BUILTIN(builtin_unix_accept)
+{
+	int fd = fd_arg(args[0], "unix_accept", assoc);
+	int client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client == -1) {
+		if (would_block()) {
+			winter_machine_wait_fd(wm, fd, EPOLLIN);
+			return value_none();
+		}
+		fatal_assoc(assoc, "Couldn't accept on fd %d: %s", fd, strerror(errno));
+	}
+	return value_new_integer(client);
+}
+
+// Connecting to a local socket doesn't wait on the network, so this
+// connects right away and only then makes the socket non-blocking
+DEFINE_BUILTIN(builtin_unix_connect)
+{
+	struct sockaddr_un address = unix_address(args[0], "unix_connect", assoc);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1 ||
+		connect(fd, (struct sockaddr*) &address, sizeof(address)) == -1 ||
+		fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+		fatal_assoc(assoc, "Couldn't connect to '%s': %s", address.sun_path, strerror(errno));
+	}
+	return value_new_integer(fd);
+}
+
+// :\ I/O
+
+Value (*builtin_functions[])(Winter_Machine*, Value*, size_t, Assoc_Source) = {
 	builtin_print,
 	builtin_read_input,
 	builtin_assert,
@@ -114,4 +682,35 @@ Value (*builtin_functions[])(Value*, size_t, Assoc_Source) = {
 	builtin_list_append,
 	builtin_list_pop,
 	builtin_list_count,
+	builtin_spawn,
+	builtin_join,
+	builtin_channel,
+	builtin_send,
+	builtin_receive,
+	builtin_par_map,
+	builtin_par_filter,
+	builtin_par_reduce,
+	builtin_pure,
+	builtin_next,
+	builtin_done,
+	builtin_go,
+	builtin_yield_fiber,
+	builtin_fd_open,
+	builtin_fd_read,
+	builtin_fd_write,
+	builtin_fd_close,
+	builtin_fd_pipe,
+	builtin_unix_listen,
+	builtin_unix_accept,
+	builtin_unix_connect,
+	builtin_range,
+	builtin_dict_remove,
+	builtin_vector,
+	builtin_vector_append,
+	builtin_vector_set,
+	builtin_vector_count,
+	builtin_map,
+	builtin_map_set,
+	builtin_map_remove,
+	builtin_map_count,
 };
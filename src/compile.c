@@ -77,14 +77,19 @@ void compile_expression(Compiler * compiler, Expr * expr)
 		break;
 	case EXPR_FIELD_ACCESS:
 		compile_expression(compiler, expr->field_access.expr);
-		P(bc_chunk_new_create_string(expr->field_access.field), expr->assoc);
-		P(bc_chunk_new_no_args(INSTR_GET_FIELD), expr->assoc);
+		P(bc_chunk_new_field(INSTR_GET_FIELD, expr->field_access.field), expr->assoc);
 		break;
 	case EXPR_UNARY: {
 		compile_expression(compiler, expr->unary.operand);
 		compile_operator(compiler, expr->unary.operator, expr->assoc);
 	} break;
 	case EXPR_BINARY: {
+		if (expr->binary.operator == OP_INDEX && expr->binary.right->type == EXPR_STRING) {
+			compile_expression(compiler, expr->binary.left);
+			P(bc_chunk_new_field(INSTR_INDEX_KEY, expr->binary.right->string.literal),
+			  expr->assoc);
+			break;
+		}
 		compile_expression(compiler, expr->binary.left);
 		compile_expression(compiler, expr->binary.right);
 		compile_operator(compiler, expr->binary.operator, expr->assoc);
@@ -151,14 +156,19 @@ void compile_assignment(Compiler * compiler, Stmt * assign)
 		}
 		compile_expression(compiler, expr);
 		compile_expression(compiler, target->binary.left);
+		if (target->binary.right->type == EXPR_STRING) {
+			// Literal keys get an inline cache
+			P(bc_chunk_new_field(INSTR_ASSIGN_KEY, target->binary.right->string.literal),
+			  assign->assoc);
+			break;
+		}
 		compile_expression(compiler, target->binary.right);
 		P(bc_chunk_new_no_args(INSTR_INDEX_ASSIGN), assign->assoc);
 		break;
 	case EXPR_FIELD_ACCESS:
 		compile_expression(compiler, expr);
 		compile_expression(compiler, target->field_access.expr);
-		P(bc_chunk_new_create_string(target->field_access.field), assign->assoc);
-		P(bc_chunk_new_no_args(INSTR_ASSIGN_FIELD), assign->assoc);
+		P(bc_chunk_new_field(INSTR_ASSIGN_FIELD, target->field_access.field), assign->assoc);
 		break;
 	default:
 	_default:
@@ -181,6 +191,10 @@ void compile_statement(Compiler * compiler, Stmt * stmt)
 		compile_expression(compiler, stmt->_return.expr);
 		P(bc_chunk_new_no_args(INSTR_RETURN), stmt->assoc);
 		break;
+	case STMT_YIELD:
+		compile_expression(compiler, stmt->_yield.expr);
+		P(bc_chunk_new_no_args(INSTR_YIELD), stmt->assoc);
+		break;
 	case STMT_IF: {
 		size_t * end_jumps = NULL;
 		for (int i = 0; i < sb_count(stmt->_if.conditions); i++) {
@@ -216,6 +230,46 @@ void compile_statement(Compiler * compiler, Stmt * stmt)
 		PNOP(); // Landing spot for loop end
 		A(loc, bc_chunk_new_set_loop(L() - loc), stmt->assoc);
 	} break;
+	case STMT_FOR: {
+		// A literal range() call counts in place rather than building
+		// the list; anything else is iterated as a collection
+		Expr * iterable = stmt->_for.iterable;
+		bool range = false;
+		if (iterable->type == EXPR_FUNCALL &&
+			iterable->funcall.func->type == EXPR_ATOM &&
+			iterable->funcall.func->atom.value.type == VALUE_BUILTIN &&
+			iterable->funcall.func->atom.value._builtin == BUILTIN_RANGE) {
+			Expr ** args = iterable->funcall.args;
+			int arg_count = sb_count(args);
+			if (arg_count >= 1 && arg_count <= 3) {
+				range = true;
+				// Always push start, stop and step
+				if (arg_count == 1) {
+					P(bc_chunk_new_push(value_new_integer(0)), iterable->assoc);
+				}
+				for (int i = 0; i < arg_count; i++) {
+					compile_expression(compiler, args[i]);
+				}
+				if (arg_count < 3) {
+					P(bc_chunk_new_push(value_new_integer(1)), iterable->assoc);
+				}
+			}
+		}
+		if (!range) {
+			compile_expression(compiler, iterable);
+		}
+		PNOP(); // SET_ITER/SET_RANGE placeholder
+		size_t loc = L();
+		P(bc_chunk_new_for_iter(stmt->_for.name), stmt->assoc);
+		compile_body(compiler, stmt->_for.body);
+		P(bc_chunk_new_no_args(INSTR_LOOP_END), stmt->assoc);
+		PNOP(); // Landing spot for loop end
+		if (range) {
+			A(loc, bc_chunk_new_set_range(L() - loc), stmt->assoc);
+		} else {
+			A(loc, bc_chunk_new_set_iter(L() - loc), stmt->assoc);
+		}
+	} break;
 	case STMT_BREAK:
 		P(bc_chunk_new_no_args(INSTR_BREAK), stmt->assoc);
 		break;
@@ -230,8 +284,15 @@ void compile_statement(Compiler * compiler, Stmt * stmt)
 		for (int i = sb_count(stmt->func_decl.parameters) - 1; i >= 0; i--) {
 			P(bc_chunk_new_create_string(stmt->func_decl.parameters[i]), stmt->assoc);
 		}
+		// Nested declarations are compiled separately, so any yield
+		// here belongs to this function
+		bool generator = false;
+		for (int i = 0; i < sb_count(decl_compiler.bytecode); i++) {
+			if (decl_compiler.bytecode[i].instr == INSTR_YIELD) generator = true;
+		}
 		P(bc_chunk_new_create_function(sb_count(stmt->func_decl.parameters),
-									   decl_compiler.bytecode),
+									   decl_compiler.bytecode, generator,
+									   stmt->func_decl.name),
 		  stmt->assoc);
 		P(bc_chunk_new_no_args(INSTR_CLOSURE), stmt->assoc);
 		P(bc_chunk_new_create_string(stmt->func_decl.name), stmt->assoc);
@@ -251,4 +312,11 @@ void compile_statement(Compiler * compiler, Stmt * stmt)
 	}
 }
 
+// Compiles a whole file into a single unit, so that the VM runs it as
+// one uninterrupted instruction stream
+void compile_program(Compiler * compiler, Stmt ** program)
+{
+	compile_body(compiler, program);
+}
+
 // :\ Compilation
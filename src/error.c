@@ -22,6 +22,22 @@ Assoc_Source assoc_source_eof(Lexer * lexer)
 	};
 }
 
+const char * assoc_source_line(Assoc_Source assoc, int * len)
+{
+	if (!assoc.lexer) {
+		*len = 0;
+		return "";
+	}
+	const char * source = assoc.lexer->source;
+	const char * start = source + assoc.position;
+	while (start > source && start[-1] != '\n') start--;
+	while (*start == ' ' || *start == '\t') start++;
+	const char * end = start;
+	while (*end && *end != '\n') end++;
+	*len = end - start;
+	return start;
+}
+
 // :\ Assoc_Source
 
 #define RESET         "\e[0m"
@@ -1,14 +1,64 @@
 #include "gc.h"
 
+#include "memprofile.h"
+
 // : GC
 
-#define ALIGNMENT 8
+typedef struct {
+	int32_t refcount;
+	GC_Finalizer finalizer;
+} GC_Header;
+
+// Keeps the allocations themselves 16-byte aligned
+#define ALIGNMENT 16
+_Static_assert(sizeof(GC_Header) <= ALIGNMENT, "GC header doesn't fit");
+
+static GC_Header * gc_header(void * internal)
+{
+	return (GC_Header*) internal;
+}
+
+static void gc_finalize(void * internal)
+{
+	GC_Header * header = gc_header(internal);
+	if (header->finalizer) {
+		header->finalizer((char*) internal + ALIGNMENT);
+		header->finalizer = NULL;
+	}
+}
 
-GC global_gc;
+_Thread_local GC * current_gc = NULL;
 
-void global_init()
+GC gc_new()
 {
-	global_gc = (GC) { NULL };
+	return (GC) { NULL, NULL };
+}
+
+// Releases every allocation, live or not. Finalizers all run before
+// anything is freed, since they can touch other allocations.
+void gc_free(GC * gc)
+{
+	for (int i = 0; i < sb_count(gc->allocations); i++) {
+		gc_finalize(gc->allocations[i]);
+	}
+	for (int i = 0; i < sb_count(gc->allocations); i++) {
+		if (gc->profile) alloc_profile_remove(gc->profile, gc->allocations[i]);
+		free(gc->allocations[i]);
+	}
+	sb_free(gc->allocations);
+	gc->allocations = NULL;
+	if (gc->profile) {
+		alloc_profile_free(gc->profile);
+		gc->profile = NULL;
+	}
+	if (current_gc == gc) {
+		current_gc = NULL;
+	}
+}
+
+void gc_make_current(GC * gc)
+{
+	current_gc = gc;
 }
 
 size_t gc_allocations(GC * gc)
@@ -16,15 +66,18 @@ size_t gc_allocations(GC * gc)
 	return sb_count(gc->allocations);
 }
 
-void * gc_alloc(GC * gc, size_t size)
+void * gc_alloc(GC * gc, size_t size, int tag)
 {
-	int32_t * allocation = malloc(size + ALIGNMENT);
-	*allocation = 0; // Zero refcount by default
+	internal_assert(gc);
+	void * allocation = malloc(size + ALIGNMENT);
+	gc_header(allocation)->refcount = 0; // Zero refcount by default
+	gc_header(allocation)->finalizer = NULL;
 	sb_push(gc->allocations, (void*) allocation);
+	if (gc->profile) alloc_profile_add(gc->profile, allocation, size, gc->site, tag);
 	return (void*) ((char*) allocation + ALIGNMENT); // Hide reference count
 }
 
-void * gc_realloc(GC * gc, void * external, size_t new_size)
+void * gc_realloc(GC * gc, void * external, size_t new_size, int tag)
 {
 	void * internal = (void*) ((char*) external - ALIGNMENT);
 	int index = -1;
@@ -38,43 +91,74 @@ void * gc_realloc(GC * gc, void * external, size_t new_size)
 	internal_assert(index != -1);
 	void * new_internal = realloc(internal, new_size + ALIGNMENT);
 	gc->allocations[index] = new_internal;
+	if (gc->profile) {
+		// Counted again in full, under whichever line grew it
+		alloc_profile_remove(gc->profile, internal);
+		alloc_profile_add(gc->profile, new_internal, new_size, gc->site, tag);
+	}
 	return (void*) ((char*) new_internal + ALIGNMENT);
 }
 
 // On external-facing pointer
 void gc_modify_refcount(void * ptr, int change)
 {
-	int32_t * refcount = (int32_t*) ((char*) ptr - ALIGNMENT);
-	*refcount += change;
+	gc_header((char*) ptr - ALIGNMENT)->refcount += change;
 }
 
 int32_t gc_get_refcount(void * ptr)
 {
-	return *((int32_t*) ((char*) ptr - ALIGNMENT));
+	return gc_header((char*) ptr - ALIGNMENT)->refcount;
+}
+
+void gc_set_finalizer(void * ptr, GC_Finalizer finalizer)
+{
+	gc_header((char*) ptr - ALIGNMENT)->finalizer = finalizer;
 }
 
 // On internal-facing pointer
 int32_t gc_get_refcount_internal(void * ptr)
 {
-	return *((int32_t*) ptr);
+	return gc_header(ptr)->refcount;
 }
 
-void gc_collect(GC * gc)
+size_t gc_collect(GC * gc)
 {
 	void ** new_allocations = NULL;
-	// Free all refcount zero or less
+	// Free all refcount zero or less. Freeing waits until every
+	// finalizer has run, since finalizers can touch other allocations.
+	void ** dead = NULL;
 	for (int i = 0; i < sb_count(gc->allocations); i++) {
 		int32_t refcount = gc_get_refcount_internal(gc->allocations[i]);
 		dbprintf("%p refcount: %d\n", gc->allocations[i], refcount);
 		if (refcount > 0) {
 			sb_push(new_allocations, gc->allocations[i]);
 		} else {
-			dbprintf("Freeing %p (external: %p)\n", gc->allocations[i], (uint8_t*) gc->allocations[i] + ALIGNMENT);
-			free(gc->allocations[i]);
+			gc_finalize(gc->allocations[i]);
+			sb_push(dead, gc->allocations[i]);
 		}
 	}
+	for (int i = 0; i < sb_count(dead); i++) {
+		dbprintf("Freeing %p (external: %p)\n", dead[i], (uint8_t*) dead[i] + ALIGNMENT);
+		if (gc->profile) alloc_profile_remove(gc->profile, dead[i]);
+		free(dead[i]);
+	}
+	size_t freed = sb_count(dead);
+	sb_free(dead);
 	sb_free(gc->allocations);
 	gc->allocations = new_allocations;
+	return freed;
+}
+
+void gc_adopt(GC * gc, GC * from)
+{
+	for (int i = 0; i < sb_count(from->allocations); i++) {
+		// Their size isn't known here, so they drop out of the
+		// profile rather than move into gc's
+		if (from->profile) alloc_profile_remove(from->profile, from->allocations[i]);
+		sb_push(gc->allocations, from->allocations[i]);
+	}
+	sb_free(from->allocations);
+	from->allocations = NULL;
 }
 
 // :\ GC
@@ -0,0 +1,353 @@
+#include "isolate.h"
+
+#include "persistent.h"
+#include "symbol.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// : Message
+
+Message message_new(Value value)
+{
+	Message message;
+	message.heap = gc_new();
+	GC * previous = current_gc;
+	gc_make_current(&message.heap);
+	message.value = value_deep_copy(value);
+	gc_make_current(previous);
+	return message;
+}
+
+Message message_new_list()
+{
+	Message message;
+	message.heap = gc_new();
+	GC * previous = current_gc;
+	gc_make_current(&message.heap);
+	message.value = value_new_list();
+	gc_make_current(previous);
+	return message;
+}
+
+void message_append(Message * message, Value value)
+{
+	GC * previous = current_gc;
+	gc_make_current(&message->heap);
+	value_append_list(message->value, value_deep_copy(value));
+	gc_make_current(previous);
+}
+
+// Adopts the message's heap into the current one
+Value message_receive(Message * message)
+{
+	gc_adopt(current_gc, &message->heap);
+	return message->value;
+}
+
+// :\ Message
+
+// : Winter_Isolate
+
+static bool names_contain(const char ** names, const char * name)
+{
+	for (int i = 0; i < sb_count(names); i++) {
+		if (names[i] == name) return true;
+	}
+	return false;
+}
+
+typedef struct {
+	Variable_Map * globals;
+	const char *** names;
+	// Functions already walked, since closures can lead back to them
+	Function ** functions;
+} Collect_Globals;
+
+static void collect_globals(Collect_Globals * collect, Value value);
+
+static void collect_global(Collect_Globals * collect, const char * name)
+{
+	if (names_contain(*collect->names, name)) return;
+	Value * global = variable_map_index(collect->globals, name);
+	if (!global) return;
+	sb_push(*collect->names, name);
+	collect_globals(collect, *global);
+}
+
+static void collect_globals_bytecode(Collect_Globals * collect, BC_Chunk * bytecode)
+{
+	const char ** referenced = NULL;
+	bytecode_referenced_names(bytecode, &referenced);
+	for (int i = 0; i < sb_count(referenced); i++) {
+		collect_global(collect, referenced[i]);
+	}
+	sb_free(referenced);
+}
+
+static void collect_globals_entry(void * data, Value key, Value value)
+{
+	collect_globals(data, value);
+}
+
+// Finds the globals that value could look up when it runs, so that
+// only those get copied into a new isolate
+static void collect_globals(Collect_Globals * collect, Value value)
+{
+	switch (value.type) {
+	case VALUE_FUNCTION: {
+		Function * func = value_function(value);
+		for (int i = 0; i < sb_count(collect->functions); i++) {
+			if (collect->functions[i] == func) return;
+		}
+		sb_push(collect->functions, func);
+		// A name the closure has is looked up there, and the entry gets
+		// copied along with the function; the rest fall through to globals
+		const char ** referenced = NULL;
+		bytecode_referenced_names(func->bytecode, &referenced);
+		for (int i = 0; i < sb_count(referenced); i++) {
+			Value * closed = variable_map_index(&func->closure, referenced[i]);
+			if (closed) {
+				collect_globals(collect, *closed);
+			} else {
+				collect_global(collect, referenced[i]);
+			}
+		}
+		sb_free(referenced);
+	} break;
+	case VALUE_LIST:
+		for (int i = 0; i < value_list(value)->size; i++) {
+			collect_globals(collect, value_list(value)->contents[i]);
+		}
+		break;
+	case VALUE_DICTIONARY:
+		for (int i = 0; i < dictionary_end(value_dictionary(value)); i++) {
+			Value * element = dictionary_value(value_dictionary(value), i);
+			if (element) collect_globals(collect, *element);
+		}
+		break;
+	case VALUE_RECORD:
+		for (int i = 0; i < value_list(value_record(value)->canon->fields)->size; i++) {
+			collect_globals(collect, value_record(value)->fields[i]);
+		}
+		break;
+	case VALUE_VECTOR:
+		for (int i = 0; i < value_vector(value)->count; i++) {
+			collect_globals(collect, *vector_index(value_vector(value), i));
+		}
+		break;
+	case VALUE_MAP:
+		map_visit(value_map(value), collect_globals_entry, collect);
+		break;
+	case VALUE_GENERATOR: {
+		Call_Frame * frame = value_generator(value)->frame;
+		if (!frame) break;
+		collect_globals_bytecode(collect, frame->bytecode);
+		for (int i = 0; i < frame->var_map.size; i++) {
+			collect_globals(collect, *frame->var_map.values[i]);
+		}
+	} break;
+	default:
+		break;
+	}
+}
+
+static const char ** reachable_globals(Winter_Machine * wm, Value * values, size_t count,
+									   const char ** names)
+{
+	Collect_Globals collect = {
+		&(winter_machine_global_frame(wm)->var_map), &names, NULL
+	};
+	for (int i = 0; i < count; i++) {
+		collect_globals(&collect, values[i]);
+	}
+	sb_free(collect.functions);
+	return names;
+}
+
+const char ** isolate_reachable_globals(Winter_Machine * wm, Value * values, size_t count)
+{
+	return reachable_globals(wm, values, count, NULL);
+}
+
+Value isolate_globals_dictionary(Winter_Machine * wm, const char ** names)
+{
+	Variable_Map * var_map = &(winter_machine_global_frame(wm)->var_map);
+	Value globals = value_new_dictionary();
+	for (int i = 0; i < sb_count(names); i++) {
+		value_add_pair_dictionary(globals, symbol_intern(names[i]),
+								  *variable_map_index(var_map, names[i]));
+	}
+	return globals;
+}
+
+void isolate_bind_globals(Winter_Machine * wm, Value globals)
+{
+	Winter_Dictionary * dict = value_dictionary(globals);
+	Variable_Map * var_map = &(winter_machine_global_frame(wm)->var_map);
+	for (int i = 0; i < dictionary_end(dict); i++) {
+		Value * element = dictionary_value(dict, i);
+		if (!element) continue;
+		Value name = dictionary_key(dict, i);
+		Value global = *element;
+		value_modify_refcount(global, 1);
+		variable_map_update(var_map, value_string(name)->contents, global);
+	}
+}
+
+static void * isolate_main(void * data)
+{
+	Winter_Isolate * isolate = data;
+	Winter_Machine * wm = winter_machine_alloc();
+
+	// [func, [args...], {name -> global}]
+	Value start = message_receive(&isolate->start);
+	Value func = value_list(start)->contents[0];
+	Winter_List * args = value_list(value_list(start)->contents[1]);
+	isolate_bind_globals(wm, value_list(start)->contents[2]);
+
+	Value result = winter_machine_call(wm, func, args->contents, args->size, isolate->assoc);
+	isolate->result = message_new(result);
+
+	winter_machine_free(wm);
+	return NULL;
+}
+
+Winter_Isolate * isolate_spawn(Winter_Machine * wm, Value func,
+							   Value * args, size_t arg_count, Assoc_Source assoc)
+{
+	const char ** names = isolate_reachable_globals(wm, &func, 1);
+	names = reachable_globals(wm, args, arg_count, names);
+
+	// Everything the isolate starts with goes into one message
+	Value arg_list = value_new_list();
+	for (int i = 0; i < arg_count; i++) {
+		value_append_list(arg_list, args[i]);
+	}
+	Value globals = isolate_globals_dictionary(wm, names);
+	sb_free(names);
+	Value start = value_new_list();
+	value_append_list(start, func);
+	value_append_list(start, arg_list);
+	value_append_list(start, globals);
+
+	Winter_Isolate * isolate = malloc(sizeof(Winter_Isolate));
+	isolate->start = message_new(start);
+	isolate->assoc = assoc;
+	atomic_init(&isolate->joined, false);
+	if (pthread_create(&isolate->thread, NULL, isolate_main, isolate) != 0) {
+		fatal_assoc(assoc, "Couldn't start isolate");
+	}
+	return isolate;
+}
+
+// Blocks until the isolate finishes, and returns its result in the
+// current heap
+Value isolate_join(Winter_Isolate * isolate, Assoc_Source assoc)
+{
+	if (atomic_exchange(&isolate->joined, true)) {
+		fatal_assoc(assoc, "Isolate already joined");
+	}
+	pthread_join(isolate->thread, NULL);
+	return message_receive(&isolate->result);
+}
+
+// :\ Winter_Isolate
+
+// : Winter_Channel
+
+Winter_Channel * channel_alloc()
+{
+	Winter_Channel * channel = malloc(sizeof(Winter_Channel));
+	pthread_mutex_init(&channel->lock, NULL);
+	pthread_cond_init(&channel->nonempty, NULL);
+	channel->queue = NULL;
+	channel->head = 0;
+	channel->event_fd = -1;
+	return channel;
+}
+
+// The event fd's counter is nonzero exactly while the queue isn't
+// empty. Both are called with the lock held.
+static void channel_signal(Winter_Channel * channel)
+{
+	if (channel->event_fd == -1) return;
+	uint64_t one = 1;
+	// Can only fail if the counter would overflow, and it never gets
+	// past one
+	(void) !write(channel->event_fd, &one, sizeof(one));
+}
+
+static void channel_drain(Winter_Channel * channel)
+{
+	if (channel->event_fd == -1) return;
+	uint64_t count;
+	(void) !read(channel->event_fd, &count, sizeof(count));
+}
+
+void channel_send(Winter_Channel * channel, Value value)
+{
+	Message message = message_new(value);
+	pthread_mutex_lock(&channel->lock);
+	if (channel->head == sb_count(channel->queue)) channel_signal(channel);
+	sb_push(channel->queue, message);
+	pthread_cond_signal(&channel->nonempty);
+	pthread_mutex_unlock(&channel->lock);
+}
+
+// Called with the lock held and the queue nonempty
+static Message channel_take(Winter_Channel * channel)
+{
+	Message message = channel->queue[channel->head++];
+	if (channel->head == sb_count(channel->queue)) {
+		sb_free(channel->queue);
+		channel->queue = NULL;
+		channel->head = 0;
+		channel_drain(channel);
+	}
+	return message;
+}
+
+int channel_wait_fd(Winter_Channel * channel, Assoc_Source assoc)
+{
+	pthread_mutex_lock(&channel->lock);
+	if (channel->event_fd == -1) {
+		channel->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (channel->event_fd == -1) {
+			fatal_assoc(assoc, "Couldn't wait on channel: %s", strerror(errno));
+		}
+		if (channel->head != sb_count(channel->queue)) channel_signal(channel);
+	}
+	int fd = channel->event_fd;
+	pthread_mutex_unlock(&channel->lock);
+	return fd;
+}
+
+// Blocks until there's a message to take
+Value channel_receive(Winter_Channel * channel)
+{
+	pthread_mutex_lock(&channel->lock);
+	while (channel->head == sb_count(channel->queue)) {
+		pthread_cond_wait(&channel->nonempty, &channel->lock);
+	}
+	Message message = channel_take(channel);
+	pthread_mutex_unlock(&channel->lock);
+	return message_receive(&message);
+}
+
+bool channel_try_receive(Winter_Channel * channel, Value * value)
+{
+	pthread_mutex_lock(&channel->lock);
+	if (channel->head == sb_count(channel->queue)) {
+		pthread_mutex_unlock(&channel->lock);
+		return false;
+	}
+	Message message = channel_take(channel);
+	pthread_mutex_unlock(&channel->lock);
+	*value = message_receive(&message);
+	return true;
+}
+
+// :\ Winter_Channel
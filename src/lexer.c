@@ -55,7 +55,9 @@ const char * lexer_intern_string(Lexer * lexer, const char * str)
 		}
 	}
 	// Not already interned
-	sb_push(lexer->interned_strings, strdup(str));
+	const char * intern = strdup(str);
+	sb_push(lexer->interned_strings, intern);
+	return intern;
 }
 
 // :\ String interning
@@ -77,6 +79,9 @@ const char * token_type_names[] = {
 	[TOKEN_CONTINUE] = "continue",
 	[TOKEN_RARROW] = "->",
 	[TOKEN_RECORD] = "record",
+	[TOKEN_YIELD] = "yield",
+	[TOKEN_FOR] = "for",
+	[TOKEN_IN] = "in",
 
 	[TOKEN_AS] = "as",
 	[TOKEN_INT] = "int",
@@ -220,6 +225,7 @@ const char * keywords[] = {
 	"and",   "as",       "int",
 	"float", "bool",     "string",
 	"list",  "while",    "record",
+	"yield", "for",      "in",
 };
 
 size_t keyword_count = sizeof(keywords) / sizeof(const char *);
@@ -232,6 +238,7 @@ Token_Type keyword_tokens[] = {
 	TOKEN_AND,   TOKEN_AS,       TOKEN_INT,
 	TOKEN_FLOAT, TOKEN_BOOL,     TOKEN_STRING,
 	TOKEN_LIST,  TOKEN_WHILE,    TOKEN_RECORD,
+	TOKEN_YIELD, TOKEN_FOR,  TOKEN_IN,
 };
 
 Token lexer_next_token(Lexer * lexer)
@@ -345,9 +352,17 @@ Token lexer_next_token(Lexer * lexer)
 		while (next_char != '"') {
 			// Escaped chars
 			if (next_char == '\\') {
-				lexer_advance_char(lexer);
-				sb_push(buffer, lexer_peek(lexer));
-				lexer_advance_char(lexer);
+				char escaped = next();
+				switch (escaped) {
+				case 'n':
+					escaped = '\n';
+					break;
+				case 't':
+					escaped = '\t';
+					break;
+				}
+				sb_push(buffer, escaped);
+				next_char = next();
 				continue;
 			}
 			sb_push(buffer, next_char);
@@ -12,6 +12,7 @@ Expr * unary_of(Operator operator, Expr * expr)
 	unary->unary.operator = operator;
 	unary->unary.operand = expr;
 	unary->assoc = expr->assoc;
+	return unary;
 }
 
 Expr * dup_expr(Expr * expr)
@@ -123,7 +124,7 @@ void lower_expression(Expr * expr)
 void lower_body(Stmt ** body)
 {
 	for (int i = 0; i < sb_count(body); i++) {
-		lower_statement(body[i]);
+		body[i] = lower_statement(body[i]);
 	}
 }
 
@@ -133,10 +134,13 @@ Stmt * lower_while(Stmt * stmt)
 	// Create lowered statement
 	Stmt * lowered = malloc(sizeof(Stmt));
 	lowered->type = STMT_LOOP;
+	lowered->assoc = stmt->assoc;
 	// Create body of lowered statement
 	Stmt ** new_body = NULL;
 	Stmt * condition = malloc(sizeof(Stmt));
 	condition->type = STMT_IF;
+	condition->assoc = stmt->assoc;
+	condition->_if.else_body = NULL;
 	// Put the condition, negated, in an if
 	condition->_if.conditions = NULL;
 	{
@@ -150,6 +154,7 @@ Stmt * lower_while(Stmt * stmt)
 		Stmt ** if_body = NULL;
 		Stmt * break_stmt = malloc(sizeof(Stmt));
 		break_stmt->type = STMT_BREAK;
+		break_stmt->assoc = stmt->assoc;
 		sb_push(if_body, break_stmt);
 		sb_push(condition->_if.bodies, if_body);
 	}
@@ -184,6 +189,9 @@ Stmt * lower_statement(Stmt * stmt)
 	case STMT_RETURN:
 		lower_expression(stmt->_return.expr);
 		return stmt;
+	case STMT_YIELD:
+		lower_expression(stmt->_yield.expr);
+		return stmt;
 	case STMT_IF:
 		for (int i = 0; i < sb_count(stmt->_if.conditions); i++) {
 			lower_expression(stmt->_if.conditions[i]);
@@ -201,6 +209,10 @@ Stmt * lower_statement(Stmt * stmt)
 		lower_body(stmt->_while.body);
 		stmt = lower_while(stmt);
 		return stmt;
+	case STMT_FOR:
+		lower_expression(stmt->_for.iterable);
+		lower_body(stmt->_for.body);
+		return stmt;
 	case STMT_BREAK:
 	case STMT_CONTINUE:
 		return stmt;
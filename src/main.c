@@ -1,10 +1,15 @@
 #include "ast.h"
+#include "bc_cache.h"
 #include "common.h"
 #include "compile.h"
 #include "gc.h"
 #include "lexer.h"
 #include "lowering.h"
+#include "memprofile.h"
+#include "opstats.h"
 #include "parser.h"
+#include "profile.h"
+#include "trace.h"
 #include "value.h"
 #include "vm.h"
 
@@ -22,23 +27,155 @@ char * load_string_from_file(char * path)
 	return str;
 }
 
+// script.w -> script.wbc
+char * path_with_extension(const char * path, const char * extension)
+{
+	size_t len = strlen(path);
+	if (len > 2 && strcmp(path + len - 2, ".w") == 0) len -= 2;
+	char * new_path = malloc(len + strlen(extension) + 1);
+	memcpy(new_path, path, len);
+	strcpy(new_path + len, extension);
+	return new_path;
+}
+
+void finish(Winter_Machine * wm, const char * folded_path)
+{
+	// Fibers still going when the program ends get to finish
+	winter_machine_join_fibers(wm);
+	if (folded_path) {
+		profile_finish(folded_path);
+	}
+	trace_finish();
+	if (wm->gc.profile) {
+		alloc_profile_report(wm->gc.profile);
+	}
+	if (wm->op_stats) {
+		op_stats_report(wm->op_stats);
+		op_stats_free(wm->op_stats);
+		wm->op_stats = NULL;
+	}
+}
+
+void execute(Winter_Machine * wm, BC_Chunk * bytecode)
+{
+	winter_machine_prime(wm, bytecode);
+	wm->running = true;
+	while (wm->running) {
+		winter_machine_step(wm);
+	}
+}
+
 int main(int argc, char ** argv)
 {
-	global_init(); // Initialize garbage collector
-	
-	if (argc != 2) {
+	const char * path = NULL;
+	bool use_cache = false;
+	bool whole_program = false;
+	bool profile = false;
+	bool opstats = false;
+	bool memprofile = false;
+	const char * trace_path = NULL;
+	// Defaults to next to the script
+	const char * folded_path = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--cache") == 0) {
+			use_cache = true;
+		} else if (strcmp(argv[i], "--whole-program") == 0) {
+			whole_program = true;
+		} else if (strncmp(argv[i], "--trace=", 8) == 0) {
+			trace_path = argv[i] + 8;
+		} else if (strcmp(argv[i], "--memprofile") == 0) {
+			memprofile = true;
+		} else if (strcmp(argv[i], "--opstats") == 0) {
+			opstats = true;
+		} else if (strcmp(argv[i], "--profile") == 0) {
+			profile = true;
+		} else if (strncmp(argv[i], "--profile=", 10) == 0) {
+			profile = true;
+			folded_path = argv[i] + 10;
+		} else if (argv[i][0] == '-') {
+			fatal("Unknown option '%s'", argv[i]);
+		} else if (path) {
+			fatal("Provide one source file");
+		} else {
+			path = argv[i];
+		}
+	}
+	if (!path) {
 		fatal("Provide one source file");
 	}
-	const char * source = load_string_from_file(argv[1]);
+	const char * source = load_string_from_file((char*) path);
 	if (!source) {
-		fatal("'%s' does not exist", argv[1]);
+		fatal("'%s' does not exist", path);
 	}
 	
 	Lexer * lexer = lexer_alloc(source);
 
 	Winter_Machine * wm = winter_machine_alloc();
+
+	if (profile) {
+		if (!folded_path) folded_path = path_with_extension(path, ".folded");
+		profile_start(wm);
+	}
+	if (opstats) {
+		wm->op_stats = op_stats_alloc();
+	}
+	if (trace_path) {
+		trace_start(wm, trace_path);
+	}
+	if (memprofile) {
+		// Reports on SIGUSR1 as well as at exit
+		wm->gc.profile = alloc_profile_new();
+		alloc_profile_catch_signal();
+	}
+
+	// Warm start: run straight from the bytecode cache
+	char * cache_path = NULL;
+	uint64_t source_hash = 0;
+	if (use_cache) {
+		cache_path = path_with_extension(path, ".wbc");
+		source_hash = bc_cache_hash_source(source);
+		BC_Chunk ** units = bc_cache_load(cache_path, source_hash, lexer);
+		if (units) {
+			for (int i = 0; i < sb_count(units); i++) {
+				execute(wm, units[i]);
+			}
+			finish(wm, folded_path);
+			winter_machine_free(wm);
+			return 0;
+		}
+	}
+
+	// Compiled units are kept around if they're going to be cached
+	BC_Chunk ** units = NULL;
+
+	if (whole_program) {
+		// Front end runs over the entire file before anything executes
+		Stmt ** program = NULL;
+		while (true) {
+			Stmt * statement = parse_statement(lexer);
+			if (!statement) break;
+			sb_push(program, lower_statement(statement));
+		}
+
+		Compiler compiler;
+		compiler.bytecode = NULL;
+		compile_program(&compiler, program);
+
+		for (int i = 0; i < sb_count(program); i++) {
+			deep_free(program[i]);
+		}
+		sb_free(program);
+
+		execute(wm, compiler.bytecode);
+
+		if (use_cache) {
+			sb_push(units, compiler.bytecode);
+		} else {
+			bc_unit_free(compiler.bytecode);
+		}
+	}
 	
-	while (true) {
+	while (!whole_program) {
 		Stmt * statement = parse_statement(lexer);
 		if (!statement) break;
 		
@@ -54,16 +191,22 @@ int main(int argc, char ** argv)
 		deep_free(statement);
 		
 		// Executing
-		winter_machine_prime(wm, compiler.bytecode);
-		wm->running = true;
-		while (wm->running) {
-			winter_machine_step(wm);
+		execute(wm, compiler.bytecode);
+
+		if (use_cache) {
+			sb_push(units, compiler.bytecode);
+		} else {
+			bc_unit_free(compiler.bytecode);
 		}
+	}
+
+	finish(wm, folded_path);
 
-		sb_free(compiler.bytecode);
+	if (use_cache) {
+		bc_cache_write(cache_path, source_hash, units);
 	}
 
-	free(wm);
+	winter_machine_free(wm);
 	
 	return 0;
 }
@@ -0,0 +1,228 @@
+#include "memprofile.h"
+
+#include <string.h>
+
+#include "value.h"
+
+// : Alloc_Profile
+
+// Where allocations of one type come from on one line
+typedef struct {
+	size_t line;
+	int tag;
+	// Of the first allocation, for showing the line's source
+	Assoc_Source assoc;
+	size_t live_bytes;
+	size_t live_count;
+	size_t total_bytes;
+	size_t total_count;
+} Alloc_Site;
+
+typedef struct {
+	void * allocation;
+	size_t size;
+	uint32_t site;
+} Alloc_Record;
+
+// Marks a removed record, so probing carries on past it
+#define TOMBSTONE ((void*) 1)
+
+struct Alloc_Profile {
+	Alloc_Site * sites; // sb
+	uint32_t ** lines;  // sb indexed by line, of sbs of indexes into sites
+	// Open-addressed table of live allocations, keyed on address
+	Alloc_Record * records;
+	size_t capacity;    // Power of two
+	size_t used;        // Records plus tombstones
+};
+
+volatile sig_atomic_t alloc_profile_requested = 0;
+
+Alloc_Profile * alloc_profile_new()
+{
+	Alloc_Profile * profile = calloc(1, sizeof(Alloc_Profile));
+	profile->capacity = 1024;
+	profile->records = calloc(profile->capacity, sizeof(Alloc_Record));
+	return profile;
+}
+
+void alloc_profile_free(Alloc_Profile * profile)
+{
+	for (int i = 0; i < sb_count(profile->lines); i++) {
+		sb_free(profile->lines[i]);
+	}
+	sb_free(profile->lines);
+	sb_free(profile->sites);
+	free(profile->records);
+	free(profile);
+}
+
+static size_t hash_pointer(void * pointer)
+{
+	uint64_t h = (uintptr_t) pointer;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// The record for allocation, or the empty slot it would go in
+static Alloc_Record * find_record(Alloc_Profile * profile, void * allocation)
+{
+	size_t mask = profile->capacity - 1;
+	Alloc_Record * reuse = NULL;
+	for (size_t i = hash_pointer(allocation) & mask;; i = (i + 1) & mask) {
+		Alloc_Record * record = profile->records + i;
+		if (record->allocation == allocation) return record;
+		if (record->allocation == TOMBSTONE) {
+			if (!reuse) reuse = record;
+		} else if (record->allocation == NULL) {
+			return reuse ? reuse : record;
+		}
+	}
+}
+
+static void grow_records(Alloc_Profile * profile)
+{
+	Alloc_Record * old = profile->records;
+	size_t old_capacity = profile->capacity;
+	size_t live = 0;
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old[i].allocation && old[i].allocation != TOMBSTONE) live++;
+	}
+	// If it's mostly tombstones, clearing them out is enough
+	if (live * 4 >= old_capacity) profile->capacity *= 2;
+	profile->records = calloc(profile->capacity, sizeof(Alloc_Record));
+	profile->used = 0;
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old[i].allocation && old[i].allocation != TOMBSTONE) {
+			*find_record(profile, old[i].allocation) = old[i];
+			profile->used++;
+		}
+	}
+	free(old);
+}
+
+static uint32_t find_site(Alloc_Profile * profile, Assoc_Source assoc, int tag)
+{
+	while (sb_count(profile->lines) <= assoc.line) {
+		sb_push(profile->lines, NULL);
+	}
+	uint32_t * line = profile->lines[assoc.line];
+	for (int i = 0; i < sb_count(line); i++) {
+		if (profile->sites[line[i]].tag == tag) return line[i];
+	}
+	uint32_t index = sb_count(profile->sites);
+	sb_push(profile->sites, ((Alloc_Site) { .line = assoc.line, .tag = tag, .assoc = assoc }));
+	sb_push(profile->lines[assoc.line], index);
+	return index;
+}
+
+static void retire(Alloc_Profile * profile, Alloc_Record * record)
+{
+	Alloc_Site * site = profile->sites + record->site;
+	site->live_bytes -= record->size;
+	site->live_count--;
+	record->allocation = TOMBSTONE;
+}
+
+void alloc_profile_add(Alloc_Profile * profile, void * allocation, size_t size,
+					   Assoc_Source site, int tag)
+{
+	if ((profile->used + 1) * 2 > profile->capacity) {
+		grow_records(profile);
+	}
+	Alloc_Record * record = find_record(profile, allocation);
+	if (record->allocation == allocation) {
+		// Memory handed back without us hearing about it (e.g. moved
+		// to another machine's heap) and now reused
+		retire(profile, record);
+	} else if (record->allocation == NULL) {
+		profile->used++;
+	}
+	uint32_t index = find_site(profile, site, tag);
+	*record = (Alloc_Record) { allocation, size, index };
+	Alloc_Site * s = profile->sites + index;
+	s->live_bytes += size;
+	s->live_count++;
+	s->total_bytes += size;
+	s->total_count++;
+}
+
+void alloc_profile_remove(Alloc_Profile * profile, void * allocation)
+{
+	Alloc_Record * record = find_record(profile, allocation);
+	if (record->allocation == allocation) {
+		retire(profile, record);
+	}
+}
+
+static void alloc_profile_request(int signum)
+{
+	alloc_profile_requested = 1;
+}
+
+void alloc_profile_catch_signal()
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = alloc_profile_request;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, NULL);
+}
+
+// :\ Alloc_Profile
+
+// : Report
+
+static int compare_sites(const void * a, const void * b)
+{
+	const Alloc_Site * x = *(const Alloc_Site **) a;
+	const Alloc_Site * y = *(const Alloc_Site **) b;
+	if (x->live_bytes != y->live_bytes) return x->live_bytes < y->live_bytes ? 1 : -1;
+	if (x->total_bytes != y->total_bytes) return x->total_bytes < y->total_bytes ? 1 : -1;
+	if (x->line != y->line) return x->line < y->line ? -1 : 1;
+	return x->tag - y->tag;
+}
+
+void alloc_profile_report(Alloc_Profile * profile)
+{
+	// Keep the report after the program's own output
+	fflush(stdout);
+
+	Alloc_Site ** sites = NULL;
+	size_t live_bytes = 0, live_count = 0, total_bytes = 0, total_count = 0;
+	for (int i = 0; i < sb_count(profile->sites); i++) {
+		Alloc_Site * site = profile->sites + i;
+		sb_push(sites, site);
+		live_bytes += site->live_bytes;
+		live_count += site->live_count;
+		total_bytes += site->total_bytes;
+		total_count += site->total_count;
+	}
+	if (sites) qsort(sites, sb_count(sites), sizeof(*sites), compare_sites);
+
+	fprintf(stderr, "Memory profile: %zu bytes live in %zu allocations, "
+			"%zu bytes allocated in %zu\n", live_bytes, live_count, total_bytes, total_count);
+	fprintf(stderr, "\n%12s %10s %12s %10s  %5s  %-10s\n",
+			"live bytes", "live", "total bytes", "total", "line", "type");
+	for (int i = 0; i < sb_count(sites); i++) {
+		Alloc_Site * site = sites[i];
+		fprintf(stderr, "%12zu %10zu %12zu %10zu  %5zu  %-10s",
+				site->live_bytes, site->live_count, site->total_bytes, site->total_count,
+				site->line, value_type_names[site->tag]);
+		if (site->assoc.lexer) {
+			int len;
+			const char * line = assoc_source_line(site->assoc, &len);
+			fprintf(stderr, " | %.*s", len, line);
+		} else {
+			fprintf(stderr, " | (no source)");
+		}
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "\n");
+	sb_free(sites);
+}
+
+// :\ Report
@@ -0,0 +1,81 @@
+#include "opstats.h"
+
+// : Op_Stats
+
+// How many of the most frequent pairs to report
+#define OP_STATS_TOP_PAIRS 25
+
+Op_Stats * op_stats_alloc()
+{
+	Op_Stats * stats = calloc(1, sizeof(Op_Stats));
+	stats->last = -1;
+	return stats;
+}
+
+void op_stats_free(Op_Stats * stats)
+{
+	free(stats);
+}
+
+typedef struct {
+	uint64_t count;
+	int first;
+	int second;
+} Op_Count;
+
+static int compare_op_counts(const void * a, const void * b)
+{
+	const Op_Count * x = a;
+	const Op_Count * y = b;
+	if (x->count != y->count) return x->count < y->count ? 1 : -1;
+	if (x->first != y->first) return x->first - y->first;
+	return x->second - y->second;
+}
+
+void op_stats_report(Op_Stats * stats)
+{
+	// Keep the report after the program's own output
+	fflush(stdout);
+
+	Op_Count * ops = NULL;
+	uint64_t total = 0;
+	for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+		if (stats->counts[i] == 0) continue;
+		sb_push(ops, ((Op_Count) { stats->counts[i], i, -1 }));
+		total += stats->counts[i];
+	}
+	if (ops) qsort(ops, sb_count(ops), sizeof(Op_Count), compare_op_counts);
+	fprintf(stderr, "Opstats: %llu instructions executed\n", (unsigned long long) total);
+	fprintf(stderr, "\n%14s %7s %7s  %s\n", "count", "%", "cumul", "instruction");
+	double cumulative = 0;
+	for (int i = 0; i < sb_count(ops); i++) {
+		double percent = 100.0 * ops[i].count / total;
+		cumulative += percent;
+		fprintf(stderr, "%14llu %6.2f%% %6.2f%%  %s\n", (unsigned long long) ops[i].count,
+				percent, cumulative, instr_names[ops[i].first]);
+	}
+	sb_free(ops);
+
+	Op_Count * pairs = NULL;
+	uint64_t pair_total = 0;
+	for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+		for (int j = 0; j < NUM_INSTRUCTIONS; j++) {
+			if (stats->pairs[i][j] == 0) continue;
+			sb_push(pairs, ((Op_Count) { stats->pairs[i][j], i, j }));
+			pair_total += stats->pairs[i][j];
+		}
+	}
+	if (pairs) qsort(pairs, sb_count(pairs), sizeof(Op_Count), compare_op_counts);
+	fprintf(stderr, "\n%14s %7s  %s\n", "count", "%", "pair");
+	for (int i = 0; i < sb_count(pairs) && i < OP_STATS_TOP_PAIRS; i++) {
+		fprintf(stderr, "%14llu %6.2f%%  %s -> %s\n", (unsigned long long) pairs[i].count,
+				100.0 * pairs[i].count / pair_total,
+				instr_names[pairs[i].first], instr_names[pairs[i].second]);
+	}
+	if (sb_count(pairs) > OP_STATS_TOP_PAIRS) {
+		fprintf(stderr, "%14s (%d more pairs)\n", "", sb_count(pairs) - OP_STATS_TOP_PAIRS);
+	}
+	sb_free(pairs);
+}
+
+// :\ Op_Stats
@@ -0,0 +1,339 @@
+#include "parallel.h"
+
+#include "builtin.h"
+#include "isolate.h"
+#include "persistent.h"
+#include "pool.h"
+
+// : Purity
+
+static bool is_pure(Variable_Map * globals, Value value, Function *** visited);
+
+static bool visited_contains(Function ** visited, Function * func)
+{
+	for (int i = 0; i < sb_count(visited); i++) {
+		if (visited[i] == func) return true;
+	}
+	return false;
+}
+
+// Names are looked up the way INSTR_GET does it: in the closure the
+// frame starts with, then in globals
+static bool bytecode_is_pure(Variable_Map * globals, Variable_Map * closure,
+							 BC_Chunk * bytecode, Function *** visited)
+{
+	for (int i = 0; i < sb_count(bytecode); i++) {
+		BC_Chunk * chunk = bytecode + i;
+		switch (chunk->instr) {
+		case INSTR_INDEX_ASSIGN:
+		case INSTR_ASSIGN_FIELD:
+		case INSTR_ASSIGN_KEY:
+			return false;
+		case INSTR_PUSH:
+			if (!is_pure(globals, chunk->instr_push.value, visited)) return false;
+			break;
+		case INSTR_GET: {
+			const char * name = chunk->instr_get.name;
+			Value * bound = variable_map_index(closure, name);
+			if (!bound) bound = variable_map_index(globals, name);
+			if (!bound) break;
+			if (!is_pure(globals, *bound, visited)) return false;
+		} break;
+		case INSTR_CREATE_FUNCTION:
+			// Closes over this frame, which starts off as our closure
+			if (!bytecode_is_pure(globals, closure,
+								  chunk->instr_create_function.bytecode, visited)) {
+				return false;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+typedef struct {
+	Variable_Map * globals;
+	Function *** visited;
+	bool pure;
+} Map_Purity;
+
+static void map_entry_is_pure(void * data, Value key, Value value)
+{
+	Map_Purity * purity = data;
+	if (purity->pure) purity->pure = is_pure(purity->globals, value, purity->visited);
+}
+
+// Anything that could end up being called has to be pure, including
+// functions carried in collections, since they can be passed in and
+// called through a parameter
+static bool is_pure(Variable_Map * globals, Value value, Function *** visited)
+{
+	switch (value.type) {
+	case VALUE_BUILTIN:
+		return builtin_purity[value._builtin];
+	case VALUE_FUNCTION: {
+		Function * func = value_function(value);
+		if (func->pure) return true;
+		if (visited_contains(*visited, func)) return true;
+		sb_push(*visited, func);
+		return bytecode_is_pure(globals, &func->closure, func->bytecode, visited);
+	} break;
+	case VALUE_LIST:
+		for (int i = 0; i < value_list(value)->size; i++) {
+			if (!is_pure(globals, value_list(value)->contents[i], visited)) return false;
+		}
+		return true;
+	case VALUE_DICTIONARY:
+		for (int i = 0; i < dictionary_end(value_dictionary(value)); i++) {
+			Value * element = dictionary_value(value_dictionary(value), i);
+			if (element && !is_pure(globals, *element, visited)) return false;
+		}
+		return true;
+	case VALUE_RECORD:
+		for (int i = 0; i < value_list(value_record(value)->canon->fields)->size; i++) {
+			if (!is_pure(globals, value_record(value)->fields[i], visited)) return false;
+		}
+		return true;
+	case VALUE_VECTOR:
+		for (int i = 0; i < value_vector(value)->count; i++) {
+			if (!is_pure(globals, *vector_index(value_vector(value), i), visited)) return false;
+		}
+		return true;
+	case VALUE_MAP: {
+		Map_Purity purity = { globals, visited, true };
+		map_visit(value_map(value), map_entry_is_pure, &purity);
+		return purity.pure;
+	} break;
+	default:
+		return true;
+	}
+}
+
+bool parallel_is_pure(Winter_Machine * wm, Value value)
+{
+	Function ** visited = NULL;
+	bool pure = is_pure(&(winter_machine_global_frame(wm)->var_map), value, &visited);
+	sb_free(visited);
+	return pure;
+}
+
+// :\ Purity
+
+// : Jobs
+
+typedef enum {
+	PAR_MAP,
+	PAR_FILTER,
+	PAR_REDUCE,
+} Par_Kind;
+
+typedef struct {
+	Winter_Machine * wm;
+	Value func;
+} Par_Worker;
+
+typedef struct {
+	Par_Kind kind;
+	Assoc_Source assoc;
+	// [func, {name -> global}], copied into each worker's machine
+	Message start;
+	// Caller's list, read-only while the job runs
+	Value * items;
+	size_t item_count;
+	size_t chunk_size;
+	size_t chunk_count;
+	Par_Worker * workers;
+	// Per chunk: a list of results for map, the reduced value for reduce
+	Message * results;
+	// Per item, for filter
+	bool * keep;
+} Par_Job;
+
+static Par_Worker par_worker_new(Par_Job * job)
+{
+	Par_Worker worker;
+	worker.wm = winter_machine_alloc();
+	Value start = value_deep_copy(job->start.value);
+	isolate_bind_globals(worker.wm, value_list(start)->contents[1]);
+	worker.func = value_list(start)->contents[0];
+	// Kept alive across calls
+	value_modify_refcount(worker.func, 1);
+	return worker;
+}
+
+// Copies an item of the caller's list into the worker's heap
+static Value par_item(Par_Job * job, Par_Worker * worker, size_t index)
+{
+	gc_make_current(&worker->wm->gc);
+	return value_deep_copy(job->items[index]);
+}
+
+static void par_run_chunk(void * context, size_t chunk, size_t worker_index)
+{
+	Par_Job * job = context;
+	Par_Worker * worker = &job->workers[worker_index];
+	if (!worker->wm) *worker = par_worker_new(job);
+
+	size_t begin = chunk * job->chunk_size;
+	size_t end = begin + job->chunk_size;
+	if (end > job->item_count) end = job->item_count;
+
+	switch (job->kind) {
+	case PAR_MAP: {
+		Message results = message_new_list();
+		for (size_t i = begin; i < end; i++) {
+			Value item = par_item(job, worker, i);
+			Value result = winter_machine_call(worker->wm, worker->func, &item, 1, job->assoc);
+			message_append(&results, result);
+		}
+		job->results[chunk] = results;
+	} break;
+	case PAR_FILTER:
+		for (size_t i = begin; i < end; i++) {
+			Value item = par_item(job, worker, i);
+			Value result = winter_machine_call(worker->wm, worker->func, &item, 1, job->assoc);
+			if (result.type != VALUE_BOOL) {
+				fatal_assoc(job->assoc, "par_filter requires a function that returns a bool");
+			}
+			job->keep[i] = result._bool;
+		}
+		break;
+	case PAR_REDUCE: {
+		Value acc = par_item(job, worker, begin);
+		value_modify_refcount(acc, 1);
+		for (size_t i = begin + 1; i < end; i++) {
+			Value args[2] = { acc, par_item(job, worker, i) };
+			Value next = winter_machine_call(worker->wm, worker->func, args, 2, job->assoc);
+			value_modify_refcount(next, 1);
+			value_modify_refcount(acc, -1);
+			acc = next;
+		}
+		job->results[chunk] = message_new(acc);
+		value_modify_refcount(acc, -1);
+	} break;
+	}
+}
+
+static Par_Job par_job_new(Winter_Machine * wm, Par_Kind kind, const char * name,
+						   Value func, Value list, Assoc_Source assoc)
+{
+	if (func.type != VALUE_FUNCTION && func.type != VALUE_BUILTIN) {
+		fatal_assoc(assoc, "%s requires a function", name);
+	}
+	if (list.type != VALUE_LIST) {
+		fatal_assoc(assoc, "%s requires a list", name);
+	}
+	if (!parallel_is_pure(wm, func)) {
+		fatal_assoc(assoc, "%s requires a pure function (use pure() to declare one)", name);
+	}
+	// The function could call anything it's handed
+	if (!parallel_is_pure(wm, list)) {
+		fatal_assoc(assoc, "%s can't hand impure functions to its workers", name);
+	}
+
+	Par_Job job;
+	job.kind = kind;
+	job.assoc = assoc;
+
+	const char ** names = isolate_reachable_globals(wm, &func, 1);
+	Value start = value_new_list();
+	value_append_list(start, func);
+	value_append_list(start, isolate_globals_dictionary(wm, names));
+	sb_free(names);
+	job.start = message_new(start);
+
+	job.items = value_list(list)->contents;
+	job.item_count = value_list(list)->size;
+	// A few chunks per worker, so stealing can even out uneven work
+	size_t worker_count = pool_worker_count();
+	job.chunk_size = job.item_count / (worker_count * 4);
+	if (job.chunk_size == 0) job.chunk_size = 1;
+	job.chunk_count = (job.item_count + job.chunk_size - 1) / job.chunk_size;
+	job.workers = calloc(worker_count, sizeof(Par_Worker));
+	job.results = malloc(sizeof(Message) * job.chunk_count);
+	job.keep = malloc(sizeof(bool) * job.item_count);
+	return job;
+}
+
+static void par_job_run(Par_Job * job)
+{
+	pool_run(job->chunk_count, par_run_chunk, job);
+}
+
+// Leaves the caller's heap current again
+static void par_job_free(Par_Job * job, Winter_Machine * wm)
+{
+	size_t worker_count = pool_worker_count();
+	for (size_t i = 0; i < worker_count; i++) {
+		if (job->workers[i].wm) winter_machine_free(job->workers[i].wm);
+	}
+	gc_free(&job->start.heap);
+	free(job->workers);
+	free(job->results);
+	free(job->keep);
+	gc_make_current(&wm->gc);
+}
+
+// :\ Jobs
+
+// : Operations
+
+Value parallel_map(Winter_Machine * wm, Value func, Value list, Assoc_Source assoc)
+{
+	Par_Job job = par_job_new(wm, PAR_MAP, "par_map", func, list, assoc);
+	par_job_run(&job);
+
+	gc_make_current(&wm->gc);
+	Value mapped = value_new_list();
+	for (size_t i = 0; i < job.chunk_count; i++) {
+		Winter_List * results = value_list(message_receive(&job.results[i]));
+		for (int j = 0; j < results->size; j++) {
+			value_append_list(mapped, results->contents[j]);
+		}
+	}
+	par_job_free(&job, wm);
+	return mapped;
+}
+
+Value parallel_filter(Winter_Machine * wm, Value func, Value list, Assoc_Source assoc)
+{
+	Par_Job job = par_job_new(wm, PAR_FILTER, "par_filter", func, list, assoc);
+	par_job_run(&job);
+
+	gc_make_current(&wm->gc);
+	Value filtered = value_new_list();
+	for (size_t i = 0; i < job.item_count; i++) {
+		if (job.keep[i]) value_append_list(filtered, job.items[i]);
+	}
+	par_job_free(&job, wm);
+	return filtered;
+}
+
+Value parallel_reduce(Winter_Machine * wm, Value func, Value list, Value init,
+					  Assoc_Source assoc)
+{
+	Par_Job job = par_job_new(wm, PAR_REDUCE, "par_reduce", func, list, assoc);
+	par_job_run(&job);
+
+	// The calling machine is mid-instruction, so the partial results
+	// get combined on a machine of their own
+	Par_Worker combiner = par_worker_new(&job);
+	Value acc = value_deep_copy(init);
+	value_modify_refcount(acc, 1);
+	for (size_t i = 0; i < job.chunk_count; i++) {
+		Value args[2] = { acc, message_receive(&job.results[i]) };
+		Value next = winter_machine_call(combiner.wm, combiner.func, args, 2, assoc);
+		value_modify_refcount(next, 1);
+		value_modify_refcount(acc, -1);
+		acc = next;
+	}
+	Message result = message_new(acc);
+	winter_machine_free(combiner.wm);
+
+	par_job_free(&job, wm);
+	return message_receive(&result);
+}
+
+// :\ Operations
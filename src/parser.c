@@ -296,6 +296,7 @@ Expr * parse_prefix(Lexer * lexer)
 		mark_expr(expr, as);
 		expr->unary.operator = OP_NOT;
 		expr->unary.operand = parse_prefix(lexer);
+		return expr;
 	} else {
 		return parse_postfix(lexer);
 	}
@@ -576,6 +577,15 @@ Stmt * parse_statement(Lexer * lexer)
 		stmt->_return.expr = parse_expression(lexer);
 		expect(';');
 		return stmt;
+	} else if (is(TOKEN_YIELD)) {
+		// yield
+		Assoc_Source as = token().assoc;
+		expect(TOKEN_YIELD);
+		STMT(STMT_YIELD);
+		mark_stmt(stmt, as);
+		stmt->_yield.expr = parse_expression(lexer);
+		expect(';');
+		return stmt;
 	} else if (is(TOKEN_IF)) {
 		// if
 		return parse_if_statement(lexer);
@@ -600,6 +610,18 @@ Stmt * parse_statement(Lexer * lexer)
 		stmt->_while.condition = parse_expression(lexer);
 		stmt->_while.body = parse_scope(lexer);
 		return stmt;
+	} else if (is(TOKEN_FOR)) {
+		Assoc_Source as = token().assoc;
+		expect(TOKEN_FOR);
+		STMT(STMT_FOR);
+		mark_stmt(stmt, as);
+		weak_expect(TOKEN_NAME);
+		stmt->_for.name = token().name;
+		advance();
+		expect(TOKEN_IN);
+		stmt->_for.iterable = parse_expression(lexer);
+		stmt->_for.body = parse_scope(lexer);
+		return stmt;
 	} else if (is(TOKEN_BREAK)) {
 		Assoc_Source as = token().assoc;
 		expect(TOKEN_BREAK);
@@ -0,0 +1,513 @@
+#include "persistent.h"
+
+#include "gc.h"
+
+// : Vector
+
+struct Vector_Node {
+	int refcount;
+	// Leaves hold values and branches hold children, which are NULL
+	// past the end of the vector
+	union {
+		Vector_Node * children[VECTOR_WIDTH];
+		Value values[VECTOR_WIDTH];
+	};
+};
+
+static Vector_Node * vector_node_new()
+{
+	// Zeroed values are none
+	Vector_Node * node = calloc(1, sizeof(Vector_Node));
+	node->refcount = 1;
+	return node;
+}
+
+// shift is zero for leaves
+static void vector_node_release(Vector_Node * node, int shift)
+{
+	if (!node || --node->refcount > 0) return;
+	for (int i = 0; i < VECTOR_WIDTH; i++) {
+		if (shift == 0) {
+			value_modify_refcount(node->values[i], -1);
+		} else {
+			vector_node_release(node->children[i], shift - VECTOR_BITS);
+		}
+	}
+	free(node);
+}
+
+// A node to change in place of the one given, sharing what it points to
+static Vector_Node * vector_node_copy(Vector_Node * node, int shift)
+{
+	Vector_Node * copy = vector_node_new();
+	if (!node) return copy;
+	*copy = *node;
+	copy->refcount = 1;
+	for (int i = 0; i < VECTOR_WIDTH; i++) {
+		if (shift == 0) {
+			value_modify_refcount(copy->values[i], 1);
+		} else if (copy->children[i]) {
+			copy->children[i]->refcount++;
+		}
+	}
+	return copy;
+}
+
+// Copies the path down to element i and puts value there
+static Vector_Node * vector_node_set(Vector_Node * node, int shift, int i, Value value)
+{
+	Vector_Node * copy = vector_node_copy(node, shift);
+	int slot = (i >> shift) & (VECTOR_WIDTH - 1);
+	if (shift == 0) {
+		value_modify_refcount(copy->values[slot], -1);
+		copy->values[slot] = value;
+		value_modify_refcount(value, 1);
+	} else {
+		Vector_Node * child = copy->children[slot];
+		copy->children[slot] = vector_node_set(child, shift - VECTOR_BITS, i, value);
+		vector_node_release(child, shift - VECTOR_BITS);
+	}
+	return copy;
+}
+
+static void vector_finalize(void * ptr)
+{
+	Winter_Vector * vector = ptr;
+	vector_node_release(vector->root, vector->shift);
+	vector->root = NULL;
+	vector->count = 0;
+}
+
+// Takes over the reference to root
+static Value vector_wrap(size_t count, int shift, Vector_Node * root)
+{
+	Winter_Vector * vector = current_alloc(sizeof(Winter_Vector), VALUE_VECTOR);
+	*vector = (Winter_Vector) { count, shift, root };
+	gc_set_finalizer(vector, vector_finalize);
+	return value_new_pointer(VALUE_VECTOR, vector);
+}
+
+Value vector_new()
+{
+	return vector_wrap(0, 0, NULL);
+}
+
+// Fills leaves in order and builds the branches over them a level at
+// a time, rather than appending one element after another
+static Value vector_build(Value * values, size_t count)
+{
+	Vector_Node ** level = NULL;
+	for (int i = 0; i < count; i += VECTOR_WIDTH) {
+		Vector_Node * leaf = vector_node_new();
+		for (int j = 0; j < VECTOR_WIDTH && i + j < count; j++) {
+			leaf->values[j] = values[i + j];
+			value_modify_refcount(leaf->values[j], 1);
+		}
+		sb_push(level, leaf);
+	}
+	int shift = 0;
+	while (sb_count(level) > 1) {
+		Vector_Node ** parents = NULL;
+		for (int i = 0; i < sb_count(level); i += VECTOR_WIDTH) {
+			Vector_Node * parent = vector_node_new();
+			for (int j = 0; j < VECTOR_WIDTH && i + j < sb_count(level); j++) {
+				parent->children[j] = level[i + j];
+			}
+			sb_push(parents, parent);
+		}
+		sb_free(level);
+		level = parents;
+		shift += VECTOR_BITS;
+	}
+	Vector_Node * root = level ? level[0] : NULL;
+	sb_free(level);
+	return vector_wrap(count, shift, root);
+}
+
+Value vector_from_list(Value list)
+{
+	internal_assert(list.type == VALUE_LIST);
+	return vector_build(value_list(list)->contents, value_list(list)->size);
+}
+
+Value * vector_index(Winter_Vector * vector, int i)
+{
+	if (i < 0 || i >= vector->count) return NULL;
+	Vector_Node * node = vector->root;
+	for (int shift = vector->shift; shift > 0; shift -= VECTOR_BITS) {
+		node = node->children[(i >> shift) & (VECTOR_WIDTH - 1)];
+	}
+	return node->values + (i & (VECTOR_WIDTH - 1));
+}
+
+Value vector_append(Value vector, Value value)
+{
+	Winter_Vector * from = value_vector(vector);
+	int shift = from->shift;
+	if (from->count < (size_t) 1 << (shift + VECTOR_BITS)) {
+		Vector_Node * root = vector_node_set(from->root, shift, from->count, value);
+		return vector_wrap(from->count + 1, shift, root);
+	}
+	// Full, so the tree grows a level with the old root on the left
+	Vector_Node * grown = vector_node_new();
+	grown->children[0] = from->root;
+	from->root->refcount++;
+	shift += VECTOR_BITS;
+	Vector_Node * root = vector_node_set(grown, shift, from->count, value);
+	vector_node_release(grown, shift);
+	return vector_wrap(from->count + 1, shift, root);
+}
+
+Value vector_set(Value vector, int i, Value value)
+{
+	Winter_Vector * from = value_vector(vector);
+	internal_assert(i >= 0 && i < from->count);
+	Vector_Node * root = vector_node_set(from->root, from->shift, i, value);
+	return vector_wrap(from->count, from->shift, root);
+}
+
+Value vector_copy(Winter_Vector * vector, Value_Copier copy, void * context)
+{
+	Value * values = NULL;
+	for (int i = 0; i < vector->count; i++) {
+		sb_push(values, copy(context, *vector_index(vector, i)));
+	}
+	Value result = vector_build(values, vector->count);
+	sb_free(values);
+	return result;
+}
+
+// :\ Vector
+
+// : Map
+
+#define MAP_BITS 5
+#define MAP_WIDTH (1 << MAP_BITS)
+// Nodes this deep have used up every bit of the hash, so they are
+// collision nodes: no bitmap, and every entry compared in turn
+#define MAP_HASH_BITS 32
+
+// Either an entry or a child node
+typedef struct {
+	Map_Node * child;
+	uint32_t hash;
+	Value key;
+	Value value;
+} Map_Slot;
+
+struct Map_Node {
+	int refcount;
+	// Bit n is set if a slot with hash fragment n is here, and slots
+	// are in fragment order
+	uint32_t bitmap;
+	int size;
+	Map_Slot slots[];
+};
+
+static Map_Node * map_node_alloc(uint32_t bitmap, int size)
+{
+	Map_Node * node = malloc(sizeof(Map_Node) + size * sizeof(Map_Slot));
+	node->refcount = 1;
+	node->bitmap = bitmap;
+	node->size = size;
+	return node;
+}
+
+static void map_slot_retain(Map_Slot * slot)
+{
+	if (slot->child) {
+		slot->child->refcount++;
+	} else {
+		value_modify_refcount(slot->key, 1);
+		value_modify_refcount(slot->value, 1);
+	}
+}
+
+static void map_node_release(Map_Node * node)
+{
+	if (!node || --node->refcount > 0) return;
+	for (int i = 0; i < node->size; i++) {
+		Map_Slot * slot = node->slots + i;
+		if (slot->child) {
+			map_node_release(slot->child);
+		} else {
+			value_modify_refcount(slot->key, -1);
+			value_modify_refcount(slot->value, -1);
+		}
+	}
+	free(node);
+}
+
+// A copy of node with remove slots taken out at position at and the
+// inserted slot, if any, put there. Every other slot's contents get a
+// reference for the copy; the inserted slot's are the caller's to give.
+static Map_Node * map_node_splice(Map_Node * node, uint32_t bitmap, int at, int remove,
+								  Map_Slot * inserted)
+{
+	int old_size = node ? node->size : 0;
+	Map_Node * copy = map_node_alloc(bitmap, old_size - remove + (inserted ? 1 : 0));
+	int to = 0;
+	for (int i = 0; i <= old_size; i++) {
+		if (i == at && inserted) copy->slots[to++] = *inserted;
+		if (i == old_size) break;
+		if (i >= at && i < at + remove) continue;
+		copy->slots[to] = node->slots[i];
+		map_slot_retain(copy->slots + to);
+		to++;
+	}
+	return copy;
+}
+
+static uint32_t map_fragment(uint32_t hash, int shift)
+{
+	return (hash >> shift) & (MAP_WIDTH - 1);
+}
+
+// Position among the node's slots of the one for fragment bit
+static int map_slot_at(uint32_t bitmap, uint32_t bit)
+{
+	return __builtin_popcount(bitmap & (bit - 1));
+}
+
+static bool map_slot_matches(Map_Slot * slot, uint32_t hash, Value key)
+{
+	return !slot->child && slot->hash == hash && slot->key.type == key.type &&
+		value_internal_equal(slot->key, key);
+}
+
+// A node holding two entries whose hashes agree up to shift
+static Map_Node * map_node_pair(int shift, Map_Slot a, Map_Slot b)
+{
+	if (shift >= MAP_HASH_BITS) {
+		Map_Node * node = map_node_alloc(0, 2);
+		node->slots[0] = a;
+		node->slots[1] = b;
+		return node;
+	}
+	uint32_t fragment_a = map_fragment(a.hash, shift);
+	uint32_t fragment_b = map_fragment(b.hash, shift);
+	if (fragment_a == fragment_b) {
+		Map_Node * node = map_node_alloc(1u << fragment_a, 1);
+		node->slots[0] = (Map_Slot) { map_node_pair(shift + MAP_BITS, a, b) };
+		return node;
+	}
+	Map_Node * node = map_node_alloc(1u << fragment_a | 1u << fragment_b, 2);
+	node->slots[fragment_a < fragment_b ? 0 : 1] = a;
+	node->slots[fragment_a < fragment_b ? 1 : 0] = b;
+	return node;
+}
+
+// Copies the path to the entry's place. The entry's references are
+// the new node's.
+static Map_Node * map_node_set(Map_Node * node, int shift, Map_Slot entry, bool * added)
+{
+	if (shift >= MAP_HASH_BITS) {
+		for (int i = 0; i < node->size; i++) {
+			if (map_slot_matches(node->slots + i, entry.hash, entry.key)) {
+				return map_node_splice(node, 0, i, 1, &entry);
+			}
+		}
+		*added = true;
+		return map_node_splice(node, 0, node->size, 0, &entry);
+	}
+	uint32_t bitmap = node ? node->bitmap : 0;
+	uint32_t bit = 1u << map_fragment(entry.hash, shift);
+	int at = map_slot_at(bitmap, bit);
+	if (!(bitmap & bit)) {
+		*added = true;
+		return map_node_splice(node, bitmap | bit, at, 0, &entry);
+	}
+	Map_Slot * slot = node->slots + at;
+	if (slot->child) {
+		Map_Slot replaced = { map_node_set(slot->child, shift + MAP_BITS, entry, added) };
+		return map_node_splice(node, bitmap, at, 1, &replaced);
+	}
+	if (map_slot_matches(slot, entry.hash, entry.key)) {
+		return map_node_splice(node, bitmap, at, 1, &entry);
+	}
+	// Two keys share the fragment, so both move down a level
+	*added = true;
+	Map_Slot existing = *slot;
+	map_slot_retain(&existing);
+	Map_Slot replaced = { map_node_pair(shift + MAP_BITS, existing, entry) };
+	return map_node_splice(node, bitmap, at, 1, &replaced);
+}
+
+// Copies the path to the key and leaves it out, giving NULL if that
+// leaves the node empty. Nothing is copied if the key isn't there.
+static Map_Node * map_node_remove(Map_Node * node, int shift, uint32_t hash, Value key,
+								  bool * found)
+{
+	if (shift >= MAP_HASH_BITS) {
+		for (int i = 0; i < node->size; i++) {
+			if (map_slot_matches(node->slots + i, hash, key)) {
+				*found = true;
+				return node->size == 1 ? NULL : map_node_splice(node, 0, i, 1, NULL);
+			}
+		}
+		return NULL;
+	}
+	uint32_t bit = 1u << map_fragment(hash, shift);
+	if (!(node->bitmap & bit)) return NULL;
+	int at = map_slot_at(node->bitmap, bit);
+	Map_Slot * slot = node->slots + at;
+	if (slot->child) {
+		Map_Node * child = map_node_remove(slot->child, shift + MAP_BITS, hash, key, found);
+		if (!*found) return NULL;
+		if (child) {
+			Map_Slot replaced = { child };
+			return map_node_splice(node, node->bitmap, at, 1, &replaced);
+		}
+	} else if (map_slot_matches(slot, hash, key)) {
+		*found = true;
+	} else {
+		return NULL;
+	}
+	if (node->size == 1) return NULL;
+	return map_node_splice(node, node->bitmap & ~bit, at, 1, NULL);
+}
+
+static void map_finalize(void * ptr)
+{
+	Winter_Map * map = ptr;
+	map_node_release(map->root);
+	map->root = NULL;
+	map->count = 0;
+}
+
+// Takes over the reference to root
+static Value map_wrap(size_t count, Map_Node * root)
+{
+	Winter_Map * map = current_alloc(sizeof(Winter_Map), VALUE_MAP);
+	*map = (Winter_Map) { count, root };
+	gc_set_finalizer(map, map_finalize);
+	return value_new_pointer(VALUE_MAP, map);
+}
+
+Value map_new()
+{
+	return map_wrap(0, NULL);
+}
+
+// Sets the key in the tree at root, which is replaced
+static void map_put(Map_Node ** root, size_t * count, Value key, Value value)
+{
+	value_modify_refcount(key, 1);
+	value_modify_refcount(value, 1);
+	bool added = false;
+	Map_Slot entry = { NULL, value_hash(key), key, value };
+	Map_Node * replaced = map_node_set(*root, 0, entry, &added);
+	map_node_release(*root);
+	*root = replaced;
+	if (added) (*count)++;
+}
+
+Value map_from_dictionary(Value dict)
+{
+	internal_assert(dict.type == VALUE_DICTIONARY);
+	Winter_Dictionary * from = value_dictionary(dict);
+	Map_Node * root = NULL;
+	size_t count = 0;
+	for (int i = 0; i < dictionary_end(from); i++) {
+		Value * value = dictionary_value(from, i);
+		if (value) map_put(&root, &count, dictionary_key(from, i), *value);
+	}
+	return map_wrap(count, root);
+}
+
+Value * map_index(Winter_Map * map, Value key)
+{
+	uint32_t hash = value_hash(key);
+	Map_Node * node = map->root;
+	for (int shift = 0; node; shift += MAP_BITS) {
+		if (shift >= MAP_HASH_BITS) {
+			for (int i = 0; i < node->size; i++) {
+				if (map_slot_matches(node->slots + i, hash, key)) {
+					return &node->slots[i].value;
+				}
+			}
+			return NULL;
+		}
+		uint32_t bit = 1u << map_fragment(hash, shift);
+		if (!(node->bitmap & bit)) return NULL;
+		Map_Slot * slot = node->slots + map_slot_at(node->bitmap, bit);
+		if (!slot->child) {
+			return map_slot_matches(slot, hash, key) ? &slot->value : NULL;
+		}
+		node = slot->child;
+	}
+	return NULL;
+}
+
+Value map_set(Value map, Value key, Value value)
+{
+	Map_Node * root = value_map(map)->root;
+	size_t count = value_map(map)->count;
+	// The new tree shares the old one's nodes
+	if (root) root->refcount++;
+	map_put(&root, &count, key, value);
+	return map_wrap(count, root);
+}
+
+bool map_remove(Value map, Value key, Value * result)
+{
+	Winter_Map * from = value_map(map);
+	if (!from->root) return false;
+	bool found = false;
+	Map_Node * root = map_node_remove(from->root, 0, value_hash(key), key, &found);
+	if (!found) return false;
+	*result = map_wrap(from->count - 1, root);
+	return true;
+}
+
+static void map_node_visit(Map_Node * node, Map_Visitor visit, void * data)
+{
+	for (int i = 0; i < node->size; i++) {
+		Map_Slot * slot = node->slots + i;
+		if (slot->child) {
+			map_node_visit(slot->child, visit, data);
+		} else {
+			visit(data, slot->key, slot->value);
+		}
+	}
+}
+
+void map_visit(Winter_Map * map, Map_Visitor visit, void * data)
+{
+	if (map->root) map_node_visit(map->root, visit, data);
+}
+
+static void append_key(void * list, Value key, Value value)
+{
+	value_append_list(*(Value*) list, key);
+}
+
+Value map_keys(Winter_Map * map)
+{
+	Value keys = value_new_list();
+	map_visit(map, append_key, &keys);
+	return keys;
+}
+
+typedef struct {
+	Value_Copier copy;
+	void * context;
+	Map_Node * root;
+	size_t count;
+} Map_Copy;
+
+static void copy_entry(void * data, Value key, Value value)
+{
+	Map_Copy * copy = data;
+	map_put(&copy->root, &copy->count,
+			copy->copy(copy->context, key), copy->copy(copy->context, value));
+}
+
+Value map_copy(Winter_Map * map, Value_Copier copy, void * context)
+{
+	Map_Copy result = { copy, context, NULL, 0 };
+	map_visit(map, copy_entry, &result);
+	return map_wrap(result.count, result.root);
+}
+
+// :\ Map
@@ -0,0 +1,130 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+// : Pool
+
+typedef struct {
+	atomic_size_t next;
+	size_t end;
+} Pool_Share;
+
+static struct {
+	pthread_once_t once;
+	// Only one job at a time, whichever thread submits it
+	pthread_mutex_t run_lock;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+	size_t worker_count;
+	size_t generation;
+	size_t active;
+
+	// The job being run
+	Pool_Task task;
+	void * context;
+	Pool_Share * shares;
+} pool = {
+	.once = PTHREAD_ONCE_INIT,
+	.run_lock = PTHREAD_MUTEX_INITIALIZER,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work_ready = PTHREAD_COND_INITIALIZER,
+	.work_done = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local bool is_pool_worker = false;
+
+static void pool_work(size_t worker)
+{
+	for (size_t i = 0; i < pool.worker_count; i++) {
+		Pool_Share * share = &pool.shares[(worker + i) % pool.worker_count];
+		while (true) {
+			size_t task = atomic_fetch_add(&share->next, 1);
+			if (task >= share->end) break;
+			pool.task(pool.context, task, worker);
+		}
+	}
+}
+
+static void * pool_worker_main(void * data)
+{
+	size_t worker = (size_t) data;
+	is_pool_worker = true;
+	size_t seen = 0;
+	pthread_mutex_lock(&pool.lock);
+	while (true) {
+		while (pool.generation == seen) {
+			pthread_cond_wait(&pool.work_ready, &pool.lock);
+		}
+		seen = pool.generation;
+		pthread_mutex_unlock(&pool.lock);
+
+		pool_work(worker);
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.active == 0) {
+			pthread_cond_signal(&pool.work_done);
+		}
+	}
+	return NULL;
+}
+
+static void pool_init()
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	pool.worker_count = cores > 0 ? cores : 1;
+	pool.generation = 0;
+	pool.active = 0;
+	for (size_t i = 0; i < pool.worker_count; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, pool_worker_main, (void*) i) != 0) {
+			fatal("Couldn't start worker thread");
+		}
+		pthread_detach(thread);
+	}
+}
+
+size_t pool_worker_count()
+{
+	pthread_once(&pool.once, pool_init);
+	return pool.worker_count;
+}
+
+void pool_run(size_t task_count, Pool_Task task, void * context)
+{
+	if (is_pool_worker) {
+		for (size_t i = 0; i < task_count; i++) {
+			task(context, i, 0);
+		}
+		return;
+	}
+
+	size_t worker_count = pool_worker_count();
+	pthread_mutex_lock(&pool.run_lock);
+
+	Pool_Share * shares = malloc(sizeof(Pool_Share) * worker_count);
+	for (size_t i = 0; i < worker_count; i++) {
+		atomic_init(&shares[i].next, task_count * i / worker_count);
+		shares[i].end = task_count * (i + 1) / worker_count;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.task = task;
+	pool.context = context;
+	pool.shares = shares;
+	pool.active = worker_count;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.work_ready);
+	while (pool.active > 0) {
+		pthread_cond_wait(&pool.work_done, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	free(shares);
+	pthread_mutex_unlock(&pool.run_lock);
+}
+
+// :\ Pool
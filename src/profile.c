@@ -0,0 +1,238 @@
+#include "profile.h"
+
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+// : Profile
+
+#define PROFILE_INTERVAL_USEC 1000
+
+atomic_int profile_ticks = 0;
+Winter_Machine * profile_machine = NULL;
+
+typedef struct {
+	size_t hits;
+	// Where the line was first sampled, for showing its source
+	Assoc_Source assoc;
+} Line_Hits;
+
+typedef struct {
+	const char * name;
+	size_t self;
+	size_t total;
+	// So recursion counts once per sample towards total
+	size_t last_sample;
+} Function_Hits;
+
+typedef struct {
+	uint64_t hash;
+	char * stack;
+	size_t hits;
+} Stack_Hits;
+
+static struct {
+	size_t samples;
+	size_t ticks;
+	Line_Hits * lines;         // sb, indexed by line
+	Function_Hits * functions; // sb
+	Stack_Hits * stacks;       // sb
+	char * scratch;            // sb, the stack being folded
+} profile;
+
+static void profile_signal(int signum)
+{
+	atomic_fetch_add_explicit(&profile_ticks, 1, memory_order_relaxed);
+}
+
+static void profile_set_timer(long usec)
+{
+	struct itimerval timer = (struct itimerval) {
+		.it_interval = { 0, usec },
+		.it_value = { 0, usec },
+	};
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void profile_start(Winter_Machine * wm)
+{
+	profile_machine = wm;
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = profile_signal;
+	// Builtins blocked in read() and the like just carry on
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPROF, &action, NULL);
+	profile_set_timer(PROFILE_INTERVAL_USEC);
+}
+
+static const char * frame_name(Winter_Machine * wm, int depth)
+{
+	Call_Frame * frame = wm->call_stack[depth];
+	if (frame->name) return frame->name;
+	if (depth == 0) {
+		return wm->fiber == wm->main_fiber ? "<main>" : "<fiber>";
+	}
+	return "<anonymous>";
+}
+
+static Function_Hits * function_hits(const char * name)
+{
+	for (int i = 0; i < sb_count(profile.functions); i++) {
+		if (strcmp(profile.functions[i].name, name) == 0) {
+			return profile.functions + i;
+		}
+	}
+	sb_push(profile.functions, ((Function_Hits) { name, 0, 0, 0 }));
+	return &sb_last(profile.functions);
+}
+
+static void scratch_append(const char * s)
+{
+	size_t len = strlen(s);
+	memcpy(sb_add(profile.scratch, len), s, len);
+}
+
+void profile_sample(Winter_Machine * wm, BC_Chunk chunk)
+{
+	int ticks = atomic_exchange_explicit(&profile_ticks, 0, memory_order_relaxed);
+	if (ticks == 0) return;
+	profile.samples++;
+	profile.ticks += ticks;
+
+	// Line
+	size_t line = chunk.assoc.line;
+	while (sb_count(profile.lines) <= line) {
+		sb_push(profile.lines, ((Line_Hits) { 0 }));
+	}
+	if (profile.lines[line].hits == 0) {
+		profile.lines[line].assoc = chunk.assoc;
+	}
+	profile.lines[line].hits += ticks;
+
+	// Functions, and the stack folded root first
+	if (profile.scratch) stb__sbn(profile.scratch) = 0;
+	int depth = sb_count(wm->call_stack);
+	for (int i = 0; i < depth; i++) {
+		const char * name = frame_name(wm, i);
+		Function_Hits * function = function_hits(name);
+		if (function->last_sample != profile.samples) {
+			function->last_sample = profile.samples;
+			function->total += ticks;
+		}
+		if (i == depth - 1) function->self += ticks;
+		if (i > 0) sb_push(profile.scratch, ';');
+		scratch_append(name);
+	}
+	sb_push(profile.scratch, '\0');
+
+	// FNV-1a, so most lookups only compare hashes
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char * p = profile.scratch; *p; p++) {
+		hash ^= (uint8_t) *p;
+		hash *= 1099511628211ULL;
+	}
+	for (int i = 0; i < sb_count(profile.stacks); i++) {
+		Stack_Hits * stack = profile.stacks + i;
+		if (stack->hash == hash && strcmp(stack->stack, profile.scratch) == 0) {
+			stack->hits += ticks;
+			return;
+		}
+	}
+	sb_push(profile.stacks, ((Stack_Hits) { hash, strdup(profile.scratch), ticks }));
+}
+
+// :\ Profile
+
+// : Report
+
+static void print_source_line(Assoc_Source assoc)
+{
+	if (!assoc.lexer) {
+		fprintf(stderr, " | (no source)");
+		return;
+	}
+	int len;
+	const char * line = assoc_source_line(assoc, &len);
+	fprintf(stderr, " | %.*s", len, line);
+}
+
+static int compare_lines(const void * a, const void * b)
+{
+	const Line_Hits * x = *(const Line_Hits **) a;
+	const Line_Hits * y = *(const Line_Hits **) b;
+	if (x->hits != y->hits) return x->hits < y->hits ? 1 : -1;
+	return x->assoc.line < y->assoc.line ? -1 : 1;
+}
+
+static int compare_functions(const void * a, const void * b)
+{
+	const Function_Hits * x = a;
+	const Function_Hits * y = b;
+	if (x->self != y->self) return x->self < y->self ? 1 : -1;
+	if (x->total != y->total) return x->total < y->total ? 1 : -1;
+	return strcmp(x->name, y->name);
+}
+
+static double percent(size_t hits)
+{
+	return 100.0 * hits / profile.ticks;
+}
+
+void profile_finish(const char * folded_path)
+{
+	profile_set_timer(0);
+	profile_machine = NULL;
+	// Keep the report after the program's own output
+	fflush(stdout);
+
+	fprintf(stderr, "Profile: %zu ticks of %dus in %zu samples\n",
+			profile.ticks, PROFILE_INTERVAL_USEC, profile.samples);
+	if (profile.ticks > 0) {
+		Line_Hits ** lines = NULL;
+		for (int i = 0; i < sb_count(profile.lines); i++) {
+			if (profile.lines[i].hits > 0) sb_push(lines, profile.lines + i);
+		}
+		qsort(lines, sb_count(lines), sizeof(*lines), compare_lines);
+		fprintf(stderr, "\n%8s %7s  %s\n", "hits", "%", "line");
+		for (int i = 0; i < sb_count(lines); i++) {
+			fprintf(stderr, "%8zu %6.2f%%  %4zu", lines[i]->hits, percent(lines[i]->hits),
+					lines[i]->assoc.line);
+			print_source_line(lines[i]->assoc);
+			fprintf(stderr, "\n");
+		}
+		sb_free(lines);
+
+		qsort(profile.functions, sb_count(profile.functions), sizeof(Function_Hits),
+			  compare_functions);
+		fprintf(stderr, "\n%8s %7s %8s %7s  %s\n", "self", "%", "total", "%", "function");
+		for (int i = 0; i < sb_count(profile.functions); i++) {
+			Function_Hits function = profile.functions[i];
+			fprintf(stderr, "%8zu %6.2f%% %8zu %6.2f%%  %s\n",
+					function.self, percent(function.self),
+					function.total, percent(function.total), function.name);
+		}
+	}
+
+	FILE * file = fopen(folded_path, "w");
+	if (file) {
+		for (int i = 0; i < sb_count(profile.stacks); i++) {
+			fprintf(file, "%s %zu\n", profile.stacks[i].stack, profile.stacks[i].hits);
+		}
+		fclose(file);
+		fprintf(stderr, "\nFolded stacks written to %s\n", folded_path);
+	} else {
+		fprintf(stderr, "\nCouldn't write folded stacks to %s\n", folded_path);
+	}
+
+	for (int i = 0; i < sb_count(profile.stacks); i++) {
+		free(profile.stacks[i].stack);
+	}
+	sb_free(profile.stacks);
+	sb_free(profile.functions);
+	sb_free(profile.lines);
+	sb_free(profile.scratch);
+}
+
+// :\ Report
@@ -0,0 +1,81 @@
+#include "reactor.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// : Reactor
+
+Reactor reactor_new()
+{
+	return (Reactor) {
+		.epoll_fd = -1,
+		.waiters = NULL,
+		.parked = 0,
+	};
+}
+
+void reactor_free(Reactor * reactor)
+{
+	if (reactor->epoll_fd != -1) {
+		close(reactor->epoll_fd);
+	}
+	for (int i = 0; i < sb_count(reactor->waiters); i++) {
+		sb_free(reactor->waiters[i].fibers);
+	}
+	sb_free(reactor->waiters);
+}
+
+void reactor_park(Reactor * reactor, int fd, uint32_t events,
+				  Fiber * fiber, Assoc_Source assoc)
+{
+	if (reactor->epoll_fd == -1) {
+		reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (reactor->epoll_fd == -1) {
+			fatal_assoc(assoc, "Couldn't create event loop: %s", strerror(errno));
+		}
+	}
+	while (sb_count(reactor->waiters) <= fd) {
+		sb_push(reactor->waiters, ((Reactor_Waiters) { NULL, 0 }));
+	}
+	Reactor_Waiters * waiters = reactor->waiters + fd;
+	waiters->events |= events;
+
+	// Registrations are one-shot, so an fd stays registered but
+	// disabled between waits
+	struct epoll_event event = { .events = waiters->events | EPOLLONESHOT, .data.fd = fd };
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1) {
+		if (errno != ENOENT ||
+			epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+			fatal_assoc(assoc, "Can't wait on fd %d: %s", fd, strerror(errno));
+		}
+	}
+	sb_push(waiters->fibers, fiber);
+	reactor->parked++;
+}
+
+void reactor_wait(Reactor * reactor, Fiber *** run_queue, int timeout)
+{
+	if (reactor->parked == 0) return;
+	struct epoll_event events[64];
+	int count;
+	do {
+		count = epoll_wait(reactor->epoll_fd, events, 64, timeout);
+	} while (count == -1 && errno == EINTR);
+	if (count == -1) {
+		fatal("Event loop failed: %s", strerror(errno));
+	}
+	for (int i = 0; i < count; i++) {
+		Reactor_Waiters * waiters = reactor->waiters + events[i].data.fd;
+		for (int j = 0; j < sb_count(waiters->fibers); j++) {
+			sb_push(*run_queue, waiters->fibers[j]);
+		}
+		reactor->parked -= sb_count(waiters->fibers);
+		sb_free(waiters->fibers);
+		waiters->fibers = NULL;
+		waiters->events = 0;
+	}
+}
+
+// :\ Reactor
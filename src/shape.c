@@ -0,0 +1,72 @@
+#include "shape.h"
+#include "symbol.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// : Shape
+
+static Dict_Shape root = { 1, 0, NULL, NULL };
+
+static pthread_mutex_t shape_lock = PTHREAD_MUTEX_INITIALIZER;
+// Both guarded by shape_lock
+static uint64_t next_id = 2;
+static size_t shape_count = 1;
+
+Dict_Shape * shape_root()
+{
+	return &root;
+}
+
+static bool key_equal(Value key, const char * chars, size_t len)
+{
+	return value_string(key)->contents == chars ||
+		(value_string(key)->size == len && memcmp(value_string(key)->contents, chars, len) == 0);
+}
+
+int shape_find(Dict_Shape * shape, const char * chars, size_t len)
+{
+	for (int i = 0; i < shape->count; i++) {
+		if (key_equal(shape->keys[i], chars, len)) return i;
+	}
+	return -1;
+}
+
+int shape_find_symbol(Dict_Shape * shape, const char * symbol)
+{
+	for (int i = 0; i < shape->count; i++) {
+		if (value_string(shape->keys[i])->contents == symbol) return i;
+	}
+	return -1;
+}
+
+Dict_Shape * shape_add(Dict_Shape * shape, const char * chars, size_t len)
+{
+	if (shape->count >= SHAPE_MAX_KEYS) return NULL;
+	pthread_mutex_lock(&shape_lock);
+	Dict_Shape * child = NULL;
+	for (int i = 0; i < sb_count(shape->transitions); i++) {
+		Dict_Shape * transition = shape->transitions[i];
+		if (key_equal(transition->keys[shape->count], chars, len)) {
+			child = transition;
+			break;
+		}
+	}
+	if (!child && shape_count < SHAPE_MAX_SHAPES) {
+		child = malloc(sizeof(Dict_Shape));
+		child->id = next_id++;
+		child->count = shape->count + 1;
+		child->keys = malloc(child->count * sizeof(Value));
+		if (shape->count > 0) {
+			memcpy(child->keys, shape->keys, shape->count * sizeof(Value));
+		}
+		child->keys[shape->count] = symbol_intern(chars);
+		child->transitions = NULL;
+		sb_push(shape->transitions, child);
+		shape_count++;
+	}
+	pthread_mutex_unlock(&shape_lock);
+	return child;
+}
+
+// :\ Shape
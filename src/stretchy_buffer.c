@@ -21,5 +21,7 @@ void * stb__copy(void * arr, size_t elem_size, size_t elem_count)
 	size_t size = elem_size * elem_count + sizeof(int) * 2;
 	void * new_arr = malloc(size);
 	memcpy(new_arr, stb__sbraw(arr), size);
+	// Only elem_count elements were allocated, whatever the original's capacity
+	((int*) new_arr)[0] = elem_count;
 	return (void*) ((int*) new_arr + 2);
 }
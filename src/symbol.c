@@ -0,0 +1,61 @@
+#include "symbol.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// : Symbol
+
+// Open addressing on the symbols' hashes, never more than half full.
+// Empty slots are VALUE_NONE.
+static Value * table;
+static size_t capacity;
+static size_t count;
+static pthread_mutex_t symbol_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Value * symbol_slot(Value * slots, size_t slot_count,
+						   const char * chars, size_t size, uint32_t hash)
+{
+	size_t i = hash & (slot_count - 1);
+	while (slots[i].type == VALUE_STRING) {
+		Winter_String * symbol = value_string(slots[i]);
+		if (symbol->size == size && value_string_hash(symbol) == hash &&
+			memcmp(symbol->contents, chars, size) == 0) {
+			break;
+		}
+		i = (i + 1) & (slot_count - 1);
+	}
+	return slots + i;
+}
+
+static void symbol_table_grow()
+{
+	size_t new_capacity = capacity ? capacity * 2 : 256;
+	Value * slots = calloc(new_capacity, sizeof(Value));
+	for (size_t i = 0; i < capacity; i++) {
+		if (table[i].type != VALUE_STRING) continue;
+		Winter_String * symbol = value_string(table[i]);
+		*symbol_slot(slots, new_capacity, symbol->contents, symbol->size,
+					 value_string_hash(symbol)) = table[i];
+	}
+	free(table);
+	table = slots;
+	capacity = new_capacity;
+}
+
+Value symbol_intern(const char * chars)
+{
+	size_t size = strlen(chars);
+	uint32_t hash = value_hash_chars(chars, size);
+	pthread_mutex_lock(&symbol_lock);
+	if ((count + 1) * 2 > capacity) symbol_table_grow();
+	Value * slot = symbol_slot(table, capacity, chars, size, hash);
+	if (slot->type != VALUE_STRING) {
+		*slot = value_new_constant_string(chars);
+		count++;
+	}
+	Value symbol = *slot;
+	pthread_mutex_unlock(&symbol_lock);
+	return symbol;
+}
+
+// :\ Symbol
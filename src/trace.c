@@ -0,0 +1,123 @@
+#include "trace.h"
+
+#include <time.h>
+
+// : Trace
+
+// The machine collects after every step, so most collections are a
+// handful of objects and over in well under a microsecond. Only ones
+// at least this long get their own slice; the rest show up in the
+// running count of freed objects.
+#define TRACE_GC_MIN_USEC 20
+// How often that count is written
+#define TRACE_GC_COUNTER_USEC 1000
+
+Winter_Machine * trace_machine = NULL;
+
+static struct {
+	FILE * file;
+	struct timespec epoch;
+	// Index + 1 is the track (tid) of each fiber seen so far
+	Fiber ** fibers;
+	size_t gc_freed;
+	double gc_counter_at;
+} trace;
+
+void trace_start(Winter_Machine * wm, const char * path)
+{
+	trace.file = fopen(path, "w");
+	if (!trace.file) {
+		fatal("Couldn't open trace file '%s'", path);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &trace.epoch);
+	fprintf(trace.file, "[\n");
+	fprintf(trace.file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+			"\"args\":{\"name\":\"winter\"}}");
+	trace_machine = wm;
+}
+
+static void trace_gc_counter(double now)
+{
+	fprintf(trace.file, ",\n{\"name\":\"gc freed\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+			"\"args\":{\"objects\":%zu}}", now, trace.gc_freed);
+	trace.gc_counter_at = now;
+}
+
+void trace_finish()
+{
+	if (!trace.file) return;
+	trace_gc_counter(trace_now());
+	fprintf(trace.file, "\n]\n");
+	fclose(trace.file);
+	trace.file = NULL;
+	sb_free(trace.fibers);
+	trace_machine = NULL;
+}
+
+double trace_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - trace.epoch.tv_sec) * 1e6 +
+		(now.tv_nsec - trace.epoch.tv_nsec) / 1e3;
+}
+
+static int trace_tid(Winter_Machine * wm)
+{
+	for (int i = 0; i < sb_count(trace.fibers); i++) {
+		if (trace.fibers[i] == wm->fiber) return i + 1;
+	}
+	// First event on this fiber, so name its track. A finished
+	// fiber's memory can be reused by a later one, which then shares
+	// its track; they never overlap in time.
+	sb_push(trace.fibers, wm->fiber);
+	int tid = sb_count(trace.fibers);
+	if (wm->fiber == wm->main_fiber) {
+		fprintf(trace.file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				"\"args\":{\"name\":\"main\"}}", tid);
+	} else {
+		fprintf(trace.file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				"\"args\":{\"name\":\"fiber %d\"}}", tid, tid - 1);
+	}
+	return tid;
+}
+
+void trace_enter(Winter_Machine * wm, const char * name)
+{
+	int tid = trace_tid(wm);
+	fprintf(trace.file, ",\n{\"name\":\"%s\",\"cat\":\"call\",\"ph\":\"B\","
+			"\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+			name ? name : "<anonymous>", trace_now(), tid);
+}
+
+void trace_exit(Winter_Machine * wm)
+{
+	int tid = trace_tid(wm);
+	fprintf(trace.file, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+			trace_now(), tid);
+}
+
+void trace_span(Winter_Machine * wm, const char * name, const char * category, double start)
+{
+	int tid = trace_tid(wm);
+	fprintf(trace.file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\","
+			"\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+			name, category, start, trace_now() - start, tid);
+}
+
+void trace_gc(Winter_Machine * wm, double start, size_t freed)
+{
+	double now = trace_now();
+	trace.gc_freed += freed;
+	if (now - start >= TRACE_GC_MIN_USEC) {
+		int tid = trace_tid(wm);
+		fprintf(trace.file, ",\n{\"name\":\"gc\",\"cat\":\"gc\",\"ph\":\"X\","
+				"\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"freed\":%zu}}",
+				start, now - start, tid, freed);
+	}
+	if (now - trace.gc_counter_at >= TRACE_GC_COUNTER_USEC) {
+		trace_gc_counter(now);
+	}
+}
+
+// :\ Trace
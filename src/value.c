@@ -3,8 +3,13 @@
 #include "gc.h"
 #include "vm.h"
 #include "builtin.h"
+#include "persistent.h"
+#include "shape.h"
+#include "symbol.h"
 
 #include <ctype.h>
+#include <stdatomic.h>
+#include <stddef.h>
 
 // : Value
 
@@ -20,6 +25,11 @@ const char * value_type_names[] = {
 	"list",
 	"dictionary",
 	"record",
+	"isolate",
+	"channel",
+	"generator",
+	"vector",
+	"map",
 };
 
 // :\ Value
@@ -28,88 +38,204 @@ const char * value_type_names[] = {
 
 Value value_none()
 {
-	return (Value) { VALUE_NONE };
+	return (Value) { .type = VALUE_NONE };
 }
 
 Value value_new_type(Value_Type t)
 {
-	return (Value) { VALUE_TYPE, ._type = (Winter_Type) { t, NULL } };
+	return (Value) { .type = VALUE_TYPE, ._type = t };
 }
 
 Value value_new_integer(int i)
 {
-	return (Value) { VALUE_INTEGER, ._integer = i };
+	Value value = { .type = VALUE_INTEGER };
+	value._integer = i;
+	return value;
 }
 
 Value value_new_float(float f)
 {
-	return (Value) { VALUE_FLOAT, ._float = f };
+	Value value = { .type = VALUE_FLOAT };
+	value._float = f;
+	return value;
 }
 
 Value value_new_bool(bool b)
 {
-	return (Value) { VALUE_BOOL, ._bool = b };
+	Value value = { .type = VALUE_BOOL };
+	value._bool = b;
+	return value;
+}
+
+Value value_new_pointer(Value_Type type, void * pointer)
+{
+	internal_assert((uintptr_t) pointer >> 48 == 0);
+	return (Value) { .type = type, ._pointer = (uintptr_t) pointer };
+}
+
+// The characters of strings that aren't short, with a reference from
+// each string using them. Strings in any machine can share one, so
+// the count is atomic.
+typedef struct {
+	atomic_int refcount;
+	char chars[];
+} String_Buffer;
+
+static String_Buffer * string_buffer(Winter_String * string)
+{
+	return (String_Buffer*) (string->contents - offsetof(String_Buffer, chars));
+}
+
+static void string_finalize(void * ptr)
+{
+	String_Buffer * buffer = string_buffer(ptr);
+	if (atomic_fetch_sub_explicit(&buffer->refcount, 1, memory_order_acq_rel) == 1) {
+		free(buffer);
+	}
+}
+
+// A string in the current heap using buffer's characters
+static Value string_sharing(String_Buffer * buffer, uint32_t size, uint32_t hash)
+{
+	atomic_fetch_add_explicit(&buffer->refcount, 1, memory_order_relaxed);
+	Winter_String * string = current_alloc(sizeof(Winter_String), VALUE_STRING);
+	*string = (Winter_String) { size, hash, false, buffer->chars };
+	gc_set_finalizer(string, string_finalize);
+	return value_new_pointer(VALUE_STRING, string);
 }
 
 Value value_new_string(const char * s)
 {
-	Winter_String string;
-	string.size = strlen(s);
-	string.contents = global_alloc(string.size + 1);
-	strcpy(string.contents, s);
-	return (Value) { VALUE_STRING, ._string = string };
+	size_t size = strlen(s);
+	if (size <= SHORT_STRING_MAX) {
+		// Zero past the characters, so the terminator is there
+		Value value = { .type = VALUE_STRING, ._short = true };
+		memcpy(&value, s, size);
+		return value;
+	}
+	String_Buffer * buffer = malloc(sizeof(String_Buffer) + size + 1);
+	atomic_init(&buffer->refcount, 0);
+	memcpy(buffer->chars, s, size + 1);
+	return string_sharing(buffer, size, 0);
+}
+
+Value value_new_constant_string(const char * s)
+{
+	size_t size = strlen(s);
+	Winter_String * string = malloc(sizeof(Winter_String) + size + 1);
+	char * contents = (char*) (string + 1);
+	memcpy(contents, s, size + 1);
+	// Hashed now, since other threads will be reading it
+	*string = (Winter_String) { size, value_hash_chars(contents, size), true, contents };
+	return value_new_pointer(VALUE_STRING, string);
 }
 
 Value value_new_function(BC_Chunk * bytecode)
 {
-	Function * func = global_alloc(sizeof(Function));
+	Function * func = current_alloc(sizeof(Function), VALUE_FUNCTION);
 	func->bytecode = bytecode;
 	func->closure = variable_map_new();
-	return (Value) {
-		VALUE_FUNCTION, ._function = func
-	};
+	func->pure = false;
+	func->generator = false;
+	func->name = NULL;
+	return value_new_pointer(VALUE_FUNCTION, func);
 }
 
 Value value_new_builtin(Builtin b)
 {
-	return (Value) { VALUE_BUILTIN, ._builtin = b };
+	Value value = { .type = VALUE_BUILTIN };
+	value._builtin = b;
+	return value;
 }
 
 Value value_new_list()
 {
-	Winter_List * list = global_alloc(sizeof(Winter_List));
+	Winter_List * list = current_alloc(sizeof(Winter_List), VALUE_LIST);
 	list->size     = 0;
 	list->capacity = 4;
-	list->contents = global_alloc(sizeof(Value) * 4);
-	return (Value) { VALUE_LIST, ._list = list };
+	list->contents = current_alloc(sizeof(Value) * 4, VALUE_LIST);
+	return value_new_pointer(VALUE_LIST, list);
 }
 
-Value * value_as_gc_pointer(Value value)
+// Other finalizers can still release the dictionary after this runs,
+// so it's left empty rather than dangling
+static void dictionary_finalize(void * ptr)
 {
-	Value * value_ptr = global_alloc(sizeof(Value));
-	memcpy(value_ptr, &value, sizeof(Value));
-	return value_ptr;
+	Winter_Dictionary * dict = ptr;
+	free(dict->shape_values);
+	free(dict->slots);
+	dict->size = 0;
+	dict->shape = shape_root();
+	dict->shape_values = NULL;
+	dict->used = 0;
+	dict->slot_count = 0;
+	dict->slots = NULL;
+	dict->entries = NULL;
 }
 
 Value value_new_dictionary()
 {
-	Winter_Dictionary * dict = global_alloc(sizeof(Winter_Dictionary));
-	dict->size   = 0;
-	dict->keys   = value_as_gc_pointer(value_new_list());
-	dict->values = value_as_gc_pointer(value_new_list());
-	return (Value) { VALUE_DICTIONARY, ._dictionary = dict };
+	Winter_Dictionary * dict = current_alloc(sizeof(Winter_Dictionary), VALUE_DICTIONARY);
+	gc_set_finalizer(dict, dictionary_finalize);
+	dict->size         = 0;
+	dict->shape        = shape_root();
+	dict->shape_values = NULL;
+	dict->used         = 0;
+	dict->slot_count   = 0;
+	dict->slots        = NULL;
+	dict->entries      = NULL;
+	return value_new_pointer(VALUE_DICTIONARY, dict);
+}
+
+Winter_Canon * value_new_canon(Value fields)
+{
+	static atomic_uint_fast64_t next_id = 1;
+	Winter_Canon * canon = current_alloc(sizeof(Winter_Canon), VALUE_TYPE);
+	canon->fields = fields;
+	canon->id = atomic_fetch_add_explicit(&next_id, 1, memory_order_relaxed);
+	return canon;
 }
 
 Value value_new_record(Winter_Canon * canon)
 {
-	Winter_Record * record = global_alloc(sizeof(Winter_Record));
+	size_t field_count = value_list(canon->fields)->size;
+	Winter_Record * record = current_alloc(sizeof(Winter_Record) + field_count * sizeof(Value),
+										   VALUE_RECORD);
 	record->canon = canon;
-	record->field_dict = value_new_dictionary();
-	size_t field_count = canon->fields._list->size;
 	for (int i = 0; i < field_count; i++) {
-		value_add_pair_dictionary(record->field_dict, canon->fields._list->contents[i], value_none());
+		record->fields[i] = value_none();
 	}
-	return (Value) { VALUE_RECORD, ._record = record };
+	return value_new_pointer(VALUE_RECORD, record);
+}
+
+Value value_new_record_type(Winter_Canon * canon)
+{
+	Value value = value_new_pointer(VALUE_TYPE, canon);
+	value._type = VALUE_RECORD;
+	return value;
+}
+
+// Releases a generator that was collected before it finished
+static void generator_finalize(void * ptr)
+{
+	Winter_Generator * generator = ptr;
+	if (generator->running || !generator->frame) return;
+	Call_Frame * frame = generator->frame;
+	call_frame_release(frame);
+	call_frame_free(frame);
+	generator->frame = NULL;
+}
+
+// A NULL frame makes a generator that has already finished
+Value value_new_generator(Call_Frame * frame)
+{
+	Winter_Generator * generator = current_alloc(sizeof(Winter_Generator), VALUE_GENERATOR);
+	gc_set_finalizer(generator, generator_finalize);
+	generator->frame = frame;
+	generator->running = false;
+	generator->done = frame == NULL;
+	if (frame) frame->generator = generator;
+	return value_new_pointer(VALUE_GENERATOR, generator);
 }
 
 // :\ Value creation
@@ -120,7 +246,7 @@ Value value_new_record(Winter_Canon * canon)
 Value value_print(Value value)
 {
 	Value s = value_cast(value, VALUE_STRING, (Assoc_Source) {0});
-	printf("%s\n", s._string.contents);
+	printf("%s\n", value_string_chars(&s));
 }
 
 #define fatal_given_type() fatal_assoc(assoc, "Not valid on given type");
@@ -223,10 +349,10 @@ bool value_internal_equal(Value a, Value b)
 	case VALUE_NONE:
 		return true;
 	case VALUE_TYPE:
-		if (a._type.type == VALUE_RECORD && b._type.type == VALUE_RECORD) {
-			return a._type.canon == b._type.canon;
+		if (a._type == VALUE_RECORD && b._type == VALUE_RECORD) {
+			return value_canon(a) == value_canon(b);
 		} else {
-			return a._type.type == b._type.type;
+			return a._type == b._type;
 		}
 	case VALUE_INTEGER:
 		return a._integer == b._integer;
@@ -234,13 +360,41 @@ bool value_internal_equal(Value a, Value b)
 		return a._float == b._float;
 	case VALUE_BOOL:
 		return a._bool == b._bool;
-	case VALUE_STRING:
-		if (a._string.size != b._string.size) return false;
-		return strncmp(a._string.contents, b._string.contents, a._string.size) == 0;
+	case VALUE_STRING: {
+		if (a._short && b._short) {
+			// Both are zero past their characters
+			return memcmp(&a, &b, sizeof(Value)) == 0;
+		}
+		size_t size = value_string_size(a);
+		if (size != value_string_size(b)) return false;
+		if (!a._short && !b._short) {
+			Winter_String * string_a = value_string(a);
+			Winter_String * string_b = value_string(b);
+			if (string_a->contents == string_b->contents) return true;
+			// Symbols are interned, so different ones never match
+			if (string_a->constant && string_b->constant) return false;
+			// Hashes only once both are known, since working one out
+			// is as slow as comparing
+			if (string_a->hash && string_b->hash && string_a->hash != string_b->hash) {
+				return false;
+			}
+		}
+		return memcmp(value_string_chars(&a), value_string_chars(&b), size) == 0;
+	}
 	case VALUE_FUNCTION:
-		return a._function == b._function;
+		return value_function(a) == value_function(b);
 	case VALUE_BUILTIN:
 		return a._builtin == b._builtin;
+	case VALUE_ISOLATE:
+		return value_isolate(a) == value_isolate(b);
+	case VALUE_CHANNEL:
+		return value_channel(a) == value_channel(b);
+	case VALUE_GENERATOR:
+		return value_generator(a) == value_generator(b);
+	case VALUE_VECTOR:
+		return value_vector(a) == value_vector(b);
+	case VALUE_MAP:
+		return value_map(a) == value_map(b);
 	case VALUE_LIST:
 		internal_assert(false); // TODO(pixlark): Do this
 	case VALUE_DICTIONARY:
@@ -301,10 +455,10 @@ static Value canon_as_str(Winter_Canon * canon)
 {
 	char buffer[512];
 	strcpy(buffer, "(");
-	size_t len = canon->fields._list->size;
+	size_t len = value_list(canon->fields)->size;
 	for (int i = 0; i < len; i++) {
 		char buf2[512];
-		const char * s = canon->fields._list->contents[i]._string.contents;
+		const char * s = value_string(value_list(canon->fields)->contents[i])->contents;
 		if (i == len - 1) {
 			sprintf(buf2, "%s", s);
 		} else {
@@ -322,12 +476,13 @@ Value value_cast_type(Value a, Value_Type type, Assoc_Source assoc)
 	case VALUE_STRING: {
 		// TODO(pixlark): static buffer
 		char buffer[512];
-		if (a._type.type == VALUE_RECORD) {
-			sprintf(buffer, "<type: %s ", value_type_names[a._type.type]);
-			strcat(buffer, canon_as_str(a._type.canon)._string.contents);
+		if (a._type == VALUE_RECORD) {
+			sprintf(buffer, "<type: %s ", value_type_names[a._type]);
+			Value fields = canon_as_str(value_canon(a));
+			strcat(buffer, value_string_chars(&fields));
 			strcat(buffer, ">");
 		} else {
-			sprintf(buffer, "<type: %s>", value_type_names[a._type.type]);
+			sprintf(buffer, "<type: %s>", value_type_names[a._type]);
 		}
 		return value_new_string(buffer);
 	} break;
@@ -389,10 +544,10 @@ Value value_cast_bool(Value a, Value_Type type, Assoc_Source assoc)
 // TODO(pixlark): Should we share string casting procedures w/ the
 // lexer? It would kind of make sense...
 
-bool string_can_be_int(Winter_String s)
+bool string_can_be_int(const char * s)
 {
-	for (int i = 0; i < s.size; i++) {
-		if (!isdigit(s.contents[i])) return false;
+	for (; *s; s++) {
+		if (!isdigit(*s)) return false;
 	}
 	return true;
 }
@@ -402,10 +557,10 @@ Value value_cast_string(Value a, Value_Type type, Assoc_Source assoc)
 {
 	switch (type) {
 	case VALUE_INTEGER: {
-		if (!string_can_be_int(a._string)) {
+		if (!string_can_be_int(value_string_chars(&a))) {
 			fatal_assoc(assoc, "String not in integer form");
 		}
-		return value_new_integer(atoi(a._string.contents));
+		return value_new_integer(atoi(value_string_chars(&a)));
 	} break;
 	case VALUE_STRING:
 		return a;
@@ -421,7 +576,7 @@ Value value_cast_function(Value a, Value_Type type, Assoc_Source assoc)
 		return a;
 	case VALUE_STRING: {
 		char buffer[512];
-		sprintf(buffer, "<function at %p>", a._function);
+		sprintf(buffer, "<function at %p>", value_function(a));
 		return value_new_string(buffer);
 	} break;
 	default:
@@ -444,22 +599,35 @@ Value value_cast_builtin(Value a, Value_Type type, Assoc_Source assoc)
 	}	
 }
 
+// Collections print to any length, so they're built up in an sb
+static void builder_append(char ** builder, const char * s)
+{
+	size_t len = strlen(s);
+	memcpy(sb_add(*builder, len), s, len);
+}
+
+static Value builder_finish(char ** builder, const char * s)
+{
+	builder_append(builder, s);
+	sb_push(*builder, '\0');
+	Value string = value_new_string(*builder);
+	sb_free(*builder);
+	return string;
+}
+
 Value value_cast_list(Value a, Value_Type type, Assoc_Source assoc)
 {
 	switch (type) {
 	case VALUE_STRING: {
-		// TODO(pixlark): This of indeterminate length, so using a
-		// static buffer is dangerous. Make a string builder and use that!
-		char buffer[512];
-		strcpy(buffer, "[");
-		for (int i = 0; i < a._list->size; i++) {
+		char * builder = NULL;
+		builder_append(&builder, "[");
+		for (int i = 0; i < value_list(a)->size; i++) {
 			// s will get collected automatically
-			Value s = value_cast(a._list->contents[i], VALUE_STRING, assoc);
-			strcat(buffer, s._string.contents);
-			if (i != a._list->size - 1) strcat(buffer, ", ");
+			Value s = value_cast(value_list(a)->contents[i], VALUE_STRING, assoc);
+			builder_append(&builder, value_string_chars(&s));
+			if (i != value_list(a)->size - 1) builder_append(&builder, ", ");
 		}
-		strcat(buffer, "]");
-		return value_new_string(buffer);
+		return builder_finish(&builder, "]");
 	} break;
 	case VALUE_LIST:
 		return a;
@@ -472,19 +640,22 @@ Value value_cast_dictionary(Value a, Value_Type type, Assoc_Source assoc)
 {
 	switch (type) {
 	case VALUE_STRING: {
-		// TODO(pixlark): See warning in value_cast_list!!
-		char buffer[512];
-		strcpy(buffer, "{");
-		for (int i = 0; i < a._dictionary->size; i++) {
-			Value k = value_cast(a._dictionary->keys->_list->contents[i], VALUE_STRING, assoc);
-			strcat(buffer, k._string.contents);
-			strcat(buffer, " -> ");
-			Value v = value_cast(a._dictionary->values->_list->contents[i], VALUE_STRING, assoc);
-			strcat(buffer, v._string.contents);
-			if (i != a._dictionary->size - 1) strcat(buffer, ", ");
-		}
-		strcat(buffer, "}");
-		return value_new_string(buffer);
+		char * builder = NULL;
+		builder_append(&builder, "{");
+		Winter_Dictionary * dict = value_dictionary(a);
+		bool first = true;
+		for (int i = 0; i < dictionary_end(dict); i++) {
+			Value * value = dictionary_value(dict, i);
+			if (!value) continue;
+			if (!first) builder_append(&builder, ", ");
+			first = false;
+			Value k = value_cast(dictionary_key(dict, i), VALUE_STRING, assoc);
+			builder_append(&builder, value_string_chars(&k));
+			builder_append(&builder, " -> ");
+			Value v = value_cast(*value, VALUE_STRING, assoc);
+			builder_append(&builder, value_string_chars(&v));
+		}
+		return builder_finish(&builder, "}");
 	} break;
 	case VALUE_DICTIONARY:
 		return a;
@@ -497,19 +668,144 @@ Value value_cast_record(Value a, Value_Type type, Assoc_Source assoc)
 {
 	switch (type) {
 	case VALUE_STRING: {
-		Value t = canon_as_str(a._record->canon);
-		Value f = value_cast_dictionary(a._record->field_dict, VALUE_STRING, assoc);
-		char buffer[1024];
-		strcpy(buffer, t._string.contents);
-		strcat(buffer, " : ");
-		strcat(buffer, f._string.contents);
-		return value_new_string(buffer);
+		Winter_Record * record = value_record(a);
+		Winter_List * names = value_list(record->canon->fields);
+		char * builder = NULL;
+		Value fields = canon_as_str(record->canon);
+		builder_append(&builder, value_string_chars(&fields));
+		builder_append(&builder, " : {");
+		for (int i = 0; i < names->size; i++) {
+			if (i > 0) builder_append(&builder, ", ");
+			builder_append(&builder, value_string(names->contents[i])->contents);
+			builder_append(&builder, " -> ");
+			Value v = value_cast(record->fields[i], VALUE_STRING, assoc);
+			builder_append(&builder, value_string_chars(&v));
+		}
+		return builder_finish(&builder, "}");
 	} break;
 	default:
 		fatal_assoc(assoc, "Cannot cast records to anything but string");
 	}
 }
 
+Value value_cast_isolate(Value a, Value_Type type, Assoc_Source assoc)
+{
+	switch (type) {
+	case VALUE_ISOLATE:
+		return a;
+	case VALUE_STRING: {
+		char buffer[512];
+		sprintf(buffer, "<isolate at %p>", value_isolate(a));
+		return value_new_string(buffer);
+	} break;
+	default:
+		fatal_assoc(assoc, "Can't cast isolate to given type");
+	}
+}
+
+Value value_cast_channel(Value a, Value_Type type, Assoc_Source assoc)
+{
+	switch (type) {
+	case VALUE_CHANNEL:
+		return a;
+	case VALUE_STRING: {
+		char buffer[512];
+		sprintf(buffer, "<channel at %p>", value_channel(a));
+		return value_new_string(buffer);
+	} break;
+	default:
+		fatal_assoc(assoc, "Can't cast channel to given type");
+	}
+}
+
+Value value_cast_generator(Value a, Value_Type type, Assoc_Source assoc)
+{
+	switch (type) {
+	case VALUE_GENERATOR:
+		return a;
+	case VALUE_STRING: {
+		char buffer[512];
+		sprintf(buffer, "<generator at %p>", value_generator(a));
+		return value_new_string(buffer);
+	} break;
+	default:
+		fatal_assoc(assoc, "Can't cast generator to given type");
+	}
+}
+
+Value value_cast_vector(Value a, Value_Type type, Assoc_Source assoc)
+{
+	Winter_Vector * vector = value_vector(a);
+	switch (type) {
+	case VALUE_STRING: {
+		char * builder = NULL;
+		builder_append(&builder, "vector[");
+		for (int i = 0; i < vector->count; i++) {
+			if (i > 0) builder_append(&builder, ", ");
+			Value s = value_cast(*vector_index(vector, i), VALUE_STRING, assoc);
+			builder_append(&builder, value_string_chars(&s));
+		}
+		return builder_finish(&builder, "]");
+	} break;
+	case VALUE_LIST: {
+		Value list = value_new_list();
+		for (int i = 0; i < vector->count; i++) {
+			value_append_list(list, *vector_index(vector, i));
+		}
+		return list;
+	} break;
+	case VALUE_VECTOR:
+		return a;
+	default:
+		fatal_assoc(assoc, "Can't cast vector to given type");
+	}
+}
+
+typedef struct {
+	char ** builder;
+	bool first;
+	Assoc_Source assoc;
+} Map_String;
+
+static void map_string_entry(void * data, Value key, Value value)
+{
+	Map_String * string = data;
+	if (!string->first) builder_append(string->builder, ", ");
+	string->first = false;
+	Value k = value_cast(key, VALUE_STRING, string->assoc);
+	builder_append(string->builder, value_string_chars(&k));
+	builder_append(string->builder, " -> ");
+	Value v = value_cast(value, VALUE_STRING, string->assoc);
+	builder_append(string->builder, value_string_chars(&v));
+}
+
+static void map_dictionary_entry(void * dict, Value key, Value value)
+{
+	value_add_pair_dictionary(*(Value*) dict, key, value);
+}
+
+Value value_cast_map(Value a, Value_Type type, Assoc_Source assoc)
+{
+	switch (type) {
+	case VALUE_STRING: {
+		char * builder = NULL;
+		builder_append(&builder, "map{");
+		Map_String string = { &builder, true, assoc };
+		map_visit(value_map(a), map_string_entry, &string);
+		return builder_finish(&builder, "}");
+	} break;
+	case VALUE_DICTIONARY: {
+		Value dict = value_new_dictionary();
+		map_visit(value_map(a), map_dictionary_entry, &dict);
+		return dict;
+	} break;
+	case VALUE_MAP:
+		return a;
+	default:
+		fatal_assoc(assoc, "Can't cast map to given type");
+	}
+}
+
 Value value_cast(Value a, Value_Type type, Assoc_Source assoc)
 {
 	switch (a.type) {
@@ -535,6 +831,16 @@ Value value_cast(Value a, Value_Type type, Assoc_Source assoc)
 		return value_cast_dictionary(a, type, assoc);
 	case VALUE_RECORD:
 		return value_cast_record(a, type, assoc);
+	case VALUE_ISOLATE:
+		return value_cast_isolate(a, type, assoc);
+	case VALUE_CHANNEL:
+		return value_cast_channel(a, type, assoc);
+	case VALUE_GENERATOR:
+		return value_cast_generator(a, type, assoc);
+	case VALUE_VECTOR:
+		return value_cast_vector(a, type, assoc);
+	case VALUE_MAP:
+		return value_cast_map(a, type, assoc);
 	default:
 		fatal_internal("Not all switch cases covered in value_cast");
 	}
@@ -547,10 +853,10 @@ Value * value_mutable_index(Value collection, Value index, Assoc_Source assoc)
 		if (index.type != VALUE_INTEGER) {
 			fatal_assoc(assoc, "Invalid index for list");
 		}
-		if (index._integer >= collection._list->size || index._integer < 0) {
+		if (index._integer >= value_list(collection)->size || index._integer < 0) {
 			fatal_assoc(assoc, "List index out of bounds");
 		}
-		return collection._list->contents + index._integer;
+		return value_list(collection)->contents + index._integer;
 	case VALUE_DICTIONARY: {
 		Value * val = value_index_dictionary(collection, index);
 		if (!val) {
@@ -558,6 +864,9 @@ Value * value_mutable_index(Value collection, Value index, Assoc_Source assoc)
 		}
 		return val;
 	} break;
+	case VALUE_VECTOR:
+	case VALUE_MAP:
+		fatal_assoc(assoc, "Can't change a %s in place", value_type_names[collection.type]);
 	default:
 		fatal_assoc(assoc, "Can't index type");
 		break;
@@ -576,13 +885,31 @@ Value value_index(Value collection, Value index, Assoc_Source assoc)
 		if (index.type != VALUE_INTEGER) {
 			fatal_assoc(assoc, "Invalid index for string");
 		}
-		if (index._integer >= collection._string.size || index._integer < 0) {
+		if (index._integer >= value_string_size(collection) || index._integer < 0) {
 			fatal_assoc(assoc, "String index out of bounds");
 		}
-		char buf[2] = {0, 0};
-		buf[0] = collection._string.contents[index._integer];
-		return value_new_string(buf);
+		char c[2] = { value_string_chars(&collection)[index._integer], 0 };
+		return value_new_string(c);
+	} break;
+	case VALUE_VECTOR: {
+		if (index.type != VALUE_INTEGER) {
+			fatal_assoc(assoc, "Invalid index for vector");
+		}
+		Value * element = vector_index(value_vector(collection), index._integer);
+		if (!element) {
+			fatal_assoc(assoc, "Vector index out of bounds");
+		}
+		return *element;
+	} break;
+	case VALUE_MAP: {
+		Value * element = map_index(value_map(collection), index);
+		if (!element) {
+			fatal_assoc(assoc, "Key not found in map");
+		}
+		return *element;
 	} break;
+	default:
+		fatal_assoc(assoc, "Can't index type");
 	}
 }
 
@@ -593,11 +920,11 @@ Value value_index(Value collection, Value index, Assoc_Source assoc)
 void value_append_list(Value value, Value to_append)
 {
 	internal_assert(value.type == VALUE_LIST);
-	Winter_List * list = value._list;
+	Winter_List * list = value_list(value);
 	if (list->size >= list->capacity) {
 		list->capacity *= 2;
-		list->contents = global_realloc(list->contents,
-										list->capacity * sizeof(Value));
+		list->contents = current_realloc(list->contents,
+										 list->capacity * sizeof(Value), VALUE_LIST);
 	}
 	list->contents[list->size] = to_append;
 	list->size++;
@@ -606,9 +933,9 @@ void value_append_list(Value value, Value to_append)
 Value value_pop_list(Value value)
 {
 	internal_assert(value.type == VALUE_LIST);
-	Winter_List * list = value._list;
+	Winter_List * list = value_list(value);
 	Value popped = list->contents[--list->size];
-	value_modify_refcount(popped, -1);
+	value_modify_refcount(popped, -value_holders(value));
 	return popped;
 }
 
@@ -626,41 +953,314 @@ void value_append(Value list, Value to_append, Assoc_Source assoc)
 
 // :\ List operations
 
+// : Record operations
+
+int value_record_field_index(Winter_Canon * canon, const char * name)
+{
+	Winter_List * names = value_list(canon->fields);
+	for (int i = 0; i < names->size; i++) {
+		if (value_string(names->contents[i])->contents == name) return i;
+	}
+	return -1;
+}
+
+// :\ Record operations
+
 // : Dictionary operations
 
-static void check_dictionary_sizes(Winter_Dictionary * dict)
+#define DICT_EMPTY     -1
+#define DICT_TOMBSTONE -2
+#define DICT_MIN_SLOTS 8
+
+// splitmix64's finalizer, so that keys which differ in only a few
+// bits (small integers, nearby pointers) still spread over the table
+static uint64_t hash_mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+uint32_t value_hash(Value value)
+{
+	uint64_t bits = 0;
+	switch (value.type) {
+	case VALUE_NONE:
+		break;
+	case VALUE_TYPE:
+		if (value._type == VALUE_RECORD) {
+			bits = (uintptr_t) value_canon(value);
+		} else {
+			bits = value._type;
+		}
+		break;
+	case VALUE_INTEGER:
+		bits = (uint32_t) value._integer;
+		break;
+	case VALUE_FLOAT: {
+		// -0.0 and 0.0 are equal, so they have to hash the same
+		float f = value._float == 0 ? 0 : value._float;
+		uint32_t u;
+		memcpy(&u, &f, sizeof(u));
+		bits = u;
+	} break;
+	case VALUE_BOOL:
+		bits = value._bool;
+		break;
+	case VALUE_STRING:
+		if (value._short) {
+			bits = value_hash_chars(value_string_chars(&value), value_string_size(value));
+		} else {
+			bits = value_string_hash(value_string(value));
+		}
+		break;
+	case VALUE_FUNCTION:
+		bits = (uintptr_t) value_function(value);
+		break;
+	case VALUE_BUILTIN:
+		bits = value._builtin;
+		break;
+	case VALUE_ISOLATE:
+		bits = (uintptr_t) value_isolate(value);
+		break;
+	case VALUE_CHANNEL:
+		bits = (uintptr_t) value_channel(value);
+		break;
+	case VALUE_GENERATOR:
+		bits = (uintptr_t) value_generator(value);
+		break;
+	case VALUE_VECTOR:
+		bits = (uintptr_t) value_vector(value);
+		break;
+	case VALUE_MAP:
+		bits = (uintptr_t) value_map(value);
+		break;
+	default:
+		// Lists and dictionaries can't be compared, so these all land
+		// together and fail in value_internal_equal, same as always
+		break;
+	}
+	return (uint32_t) hash_mix(bits ^ ((uint64_t) value.type << 56));
+}
+
+// Entries fill up to two thirds of the table, which keeps probes
+// short and means they always reach an empty slot
+static size_t dictionary_capacity(size_t slot_count)
 {
-	size_t dict_size = dict->size;
-	size_t keys_size = dict->keys->_list->size;
-	size_t vals_size = dict->values->_list->size;
-	if (dict_size != keys_size ||
-		keys_size != vals_size ||
-		vals_size != dict_size) {
-		fatal_internal("Dictionary sizes fallen out of sync: d:%d vs k:%d vs v:%d",
-					   dict_size, keys_size, vals_size);
+	return slot_count * 2 / 3;
+}
+
+// The slot holding key's entry, or if it isn't there, the slot it
+// should go in: the first tombstone passed on the way, if any
+static size_t dictionary_find_slot(Winter_Dictionary * dict, Value key, uint32_t hash,
+								   bool * found)
+{
+	size_t mask = dict->slot_count - 1;
+	size_t slot = hash & mask;
+	size_t insert_at = SIZE_MAX;
+	while (true) {
+		int32_t index = dict->slots[slot];
+		if (index == DICT_EMPTY) {
+			*found = false;
+			return insert_at != SIZE_MAX ? insert_at : slot;
+		}
+		if (index == DICT_TOMBSTONE) {
+			if (insert_at == SIZE_MAX) insert_at = slot;
+		} else {
+			Winter_Dict_Entry * entry = dict->entries + index;
+			if (entry->hash == hash && entry->key.type == key.type &&
+				value_internal_equal(entry->key, key)) {
+				*found = true;
+				return slot;
+			}
+		}
+		slot = (slot + 1) & mask;
+	}
+}
+
+// Moves the live entries into a new block with a table of slot_count,
+// dropping deleted entries and tombstones. Hashes are kept in the
+// entries, so nothing is hashed again.
+static void dictionary_rebuild(Winter_Dictionary * dict, size_t slot_count)
+{
+	size_t capacity = dictionary_capacity(slot_count);
+	int32_t * slots = malloc(slot_count * sizeof(int32_t) +
+							 capacity * sizeof(Winter_Dict_Entry));
+	Winter_Dict_Entry * entries = (Winter_Dict_Entry*) (slots + slot_count);
+	for (size_t i = 0; i < slot_count; i++) {
+		slots[i] = DICT_EMPTY;
+	}
+	size_t mask = slot_count - 1;
+	size_t used = 0;
+	for (size_t i = 0; i < dict->used; i++) {
+		if (dict->entries[i].deleted) continue;
+		entries[used] = dict->entries[i];
+		size_t slot = entries[used].hash & mask;
+		while (slots[slot] != DICT_EMPTY) {
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = used;
+		used++;
 	}
+	free(dict->slots);
+	dict->slots = slots;
+	dict->entries = entries;
+	dict->slot_count = slot_count;
+	dict->used = used;
+}
+
+static void dictionary_reserve_one(Winter_Dictionary * dict)
+{
+	if (dict->used < dictionary_capacity(dict->slot_count)) return;
+	// Sized for the live entries with as much room again, so a
+	// dictionary that's mostly deleted entries can shrink
+	size_t slot_count = DICT_MIN_SLOTS;
+	while (dictionary_capacity(slot_count) < (dict->size + 1) * 2) {
+		slot_count *= 2;
+	}
+	dictionary_rebuild(dict, slot_count);
+}
+
+static Value * hashed_index(Winter_Dictionary * dict, Value key)
+{
+	if (dict->size == 0) return NULL;
+	bool found;
+	size_t slot = dictionary_find_slot(dict, key, value_hash(key), &found);
+	if (!found) return NULL;
+	return &dict->entries[dict->slots[slot]].value;
+}
+
+static void hashed_add(Winter_Dictionary * dict, Value key, Value value)
+{
+	uint32_t hash = value_hash(key);
+	bool found;
+	if (dict->size > 0) {
+		size_t slot = dictionary_find_slot(dict, key, hash, &found);
+		if (found) {
+			dict->entries[dict->slots[slot]].value = value;
+			return;
+		}
+	}
+	// Looked up again after a rebuild, to find the slot in the new table
+	dictionary_reserve_one(dict);
+	size_t slot = dictionary_find_slot(dict, key, hash, &found);
+	dict->slots[slot] = dict->used;
+	dict->entries[dict->used] = (Winter_Dict_Entry) { key, value, hash, false };
+	dict->used++;
+	dict->size++;
+}
+
+// Slot arrays grow by doubling from four
+static size_t shape_values_capacity(size_t count)
+{
+	size_t capacity = 4;
+	while (capacity < count) capacity *= 2;
+	return capacity;
+}
+
+static int shaped_find(Winter_Dictionary * dict, Value key)
+{
+	if (key.type != VALUE_STRING) return -1;
+	if (value_string_constant(key)) {
+		return shape_find_symbol(dict->shape, value_string(key)->contents);
+	}
+	return shape_find(dict->shape, value_string_chars(&key), value_string_size(key));
+}
+
+// Turns a shaped dictionary hashed. The shape's keys are symbols, so
+// they need no references.
+static void dictionary_unshape(Winter_Dictionary * dict)
+{
+	Dict_Shape * shape = dict->shape;
+	Value * values = dict->shape_values;
+	dict->shape = NULL;
+	dict->shape_values = NULL;
+	dict->size = 0;
+	for (int i = 0; i < shape->count; i++) {
+		hashed_add(dict, shape->keys[i], values[i]);
+	}
+	free(values);
 }
 
 Value * value_index_dictionary(Value collection, Value key)
 {
 	internal_assert(collection.type == VALUE_DICTIONARY);
-	Winter_Dictionary * dict = collection._dictionary;
-	check_dictionary_sizes(dict);
-	for (int i = 0; i < dict->size; i++) {
-		if (value_internal_equal(key, dict->keys->_list->contents[i])) {
-			return dict->values->_list->contents + i;
-		}
+	Winter_Dictionary * dict = value_dictionary(collection);
+	if (dict->shape) {
+		int i = shaped_find(dict, key);
+		return i == -1 ? NULL : dict->shape_values + i;
 	}
-	return NULL;
+	return hashed_index(dict, key);
 }
 
 void value_add_pair_dictionary(Value dict, Value key, Value value)
 {
 	internal_assert(dict.type == VALUE_DICTIONARY);
-	check_dictionary_sizes(dict._dictionary);
-	dict._dictionary->size++;
-	value_append_list(*(dict._dictionary->keys), key);
-	value_append_list(*(dict._dictionary->values), value);
+	Winter_Dictionary * d = value_dictionary(dict);
+	if (d->shape && key.type == VALUE_STRING) {
+		int i = shaped_find(d, key);
+		if (i != -1) {
+			d->shape_values[i] = value;
+			return;
+		}
+		Dict_Shape * next = shape_add(d->shape, value_string_chars(&key), value_string_size(key));
+		if (next) {
+			size_t count = d->shape->count;
+			if (count == 0 || (count >= 4 && (count & (count - 1)) == 0)) {
+				d->shape_values = realloc(d->shape_values,
+										  shape_values_capacity(count + 1) * sizeof(Value));
+			}
+			d->shape_values[count] = value;
+			d->shape = next;
+			d->size++;
+			return;
+		}
+	}
+	if (d->shape) dictionary_unshape(d);
+	hashed_add(d, key, value);
+}
+
+bool value_remove_dictionary(Value dict, Value key, Value * removed)
+{
+	internal_assert(dict.type == VALUE_DICTIONARY);
+	Winter_Dictionary * d = value_dictionary(dict);
+	if (d->shape) {
+		if (shaped_find(d, key) == -1) return false;
+		dictionary_unshape(d);
+	}
+	if (d->size == 0) return false;
+	bool found;
+	size_t slot = dictionary_find_slot(d, key, value_hash(key), &found);
+	if (!found) return false;
+	Winter_Dict_Entry * entry = d->entries + d->slots[slot];
+	d->slots[slot] = DICT_TOMBSTONE;
+	d->size--;
+	int32_t holders = value_holders(dict);
+	value_modify_refcount(entry->key, -holders);
+	value_modify_refcount(entry->value, -holders);
+	*removed = entry->value;
+	*entry = (Winter_Dict_Entry) { value_none(), value_none(), 0, true };
+	return true;
+}
+
+size_t dictionary_end(Winter_Dictionary * dict)
+{
+	return dict->shape ? dict->shape->count : dict->used;
+}
+
+Value * dictionary_value(Winter_Dictionary * dict, size_t i)
+{
+	if (dict->shape) return dict->shape_values + i;
+	return dict->entries[i].deleted ? NULL : &dict->entries[i].value;
+}
+
+Value dictionary_key(Winter_Dictionary * dict, size_t i)
+{
+	if (dict->shape) return dict->shape->keys[i];
+	return dict->entries[i].key;
 }
 
 void value_add_pair(Value dict, Value key, Value value, Assoc_Source assoc)
@@ -676,6 +1276,31 @@ void value_add_pair(Value dict, Value key, Value value, Assoc_Source assoc)
 
 // :\ Dictionary operations
 
+// : String operations
+
+uint32_t value_hash_chars(const char * chars, size_t size)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (uint8_t) chars[i];
+		hash *= 16777619u;
+	}
+	// Zero means not worked out yet
+	if (hash == 0) hash = 1;
+	return hash;
+}
+
+uint32_t value_string_hash(Winter_String * string)
+{
+	if (string->hash) return string->hash;
+	uint32_t hash = value_hash_chars(string->contents, string->size);
+	string->hash = hash;
+	return hash;
+}
+
+// :\ String operations
+
 // : Value GC
 
 void value_modify_refcount(Value value, int change)
@@ -684,9 +1309,9 @@ void value_modify_refcount(Value value, int change)
 	case VALUE_NONE:
 		break;
 	case VALUE_TYPE:
-		if (value._type.type == VALUE_RECORD) {
-			gc_modify_refcount(value._type.canon, change);
-			value_modify_refcount(value._type.canon->fields, change);
+		if (value._type == VALUE_RECORD) {
+			gc_modify_refcount(value_canon(value), change);
+			value_modify_refcount(value_canon(value)->fields, change);
 		}
 		break;
 	case VALUE_INTEGER:
@@ -696,37 +1321,244 @@ void value_modify_refcount(Value value, int change)
 	case VALUE_BOOL:
 		break;
 	case VALUE_STRING:
-		gc_modify_refcount(value._string.contents, change);
+		if (!value._short && !value_string(value)->constant) {
+			gc_modify_refcount(value_string(value), change);
+		}
 		break;
 	case VALUE_FUNCTION:
-		gc_modify_refcount(value._function, change);
-		value_modify_refcount(value._function->parameter_list, change);
+		gc_modify_refcount(value_function(value), change);
+		value_modify_refcount(value_function(value)->parameter_list, change);
 		break;
 	case VALUE_BUILTIN:
 		break;
 	case VALUE_LIST:
-		gc_modify_refcount(value._list, change);
-		gc_modify_refcount(value._list->contents, change);
-		for (int i = 0; i < value._list->size; i++) {
-			value_modify_refcount(value._list->contents[i], change);
+		gc_modify_refcount(value_list(value), change);
+		gc_modify_refcount(value_list(value)->contents, change);
+		for (int i = 0; i < value_list(value)->size; i++) {
+			value_modify_refcount(value_list(value)->contents[i], change);
 		}
 		break;
 	case VALUE_DICTIONARY:
-		gc_modify_refcount(value._dictionary, change);
-		gc_modify_refcount(value._dictionary->keys, change);
-		value_modify_refcount(*value._dictionary->keys, change);
-		gc_modify_refcount(value._dictionary->values, change);
-		value_modify_refcount(*value._dictionary->values, change);
+		gc_modify_refcount(value_dictionary(value), change);
+		if (value_dictionary(value)->shape) {
+			// Keys belong to the shape
+			for (int i = 0; i < value_dictionary(value)->shape->count; i++) {
+				value_modify_refcount(value_dictionary(value)->shape_values[i], change);
+			}
+			break;
+		}
+		// Deleted entries are none -> none, so they needn't be skipped
+		for (int i = 0; i < value_dictionary(value)->used; i++) {
+			value_modify_refcount(value_dictionary(value)->entries[i].key, change);
+			value_modify_refcount(value_dictionary(value)->entries[i].value, change);
+		}
 		break;
 	case VALUE_RECORD:
-		gc_modify_refcount(value._record, change);
-		gc_modify_refcount(value._record->canon, change);
-		value_modify_refcount(value._record->canon->fields, change);
-		value_modify_refcount(value._record->field_dict, change);
+		gc_modify_refcount(value_record(value), change);
+		gc_modify_refcount(value_record(value)->canon, change);
+		value_modify_refcount(value_record(value)->canon->fields, change);
+		for (int i = 0; i < value_list(value_record(value)->canon->fields)->size; i++) {
+			value_modify_refcount(value_record(value)->fields[i], change);
+		}
+		break;
+	case VALUE_ISOLATE:
+	case VALUE_CHANNEL:
+		// Not heap allocated
+		break;
+	case VALUE_GENERATOR:
+		// The frame manages its own references
+		gc_modify_refcount(value_generator(value), change);
+		break;
+	case VALUE_VECTOR:
+		// The nodes hold their own references
+		gc_modify_refcount(value_vector(value), change);
+		break;
+	case VALUE_MAP:
+		gc_modify_refcount(value_map(value), change);
 		break;
 	default:
 		fatal_internal("Switch statement in value_modify_refcount not complete");
 	}
 }
 
+int32_t value_holders(Value collection)
+{
+	switch (collection.type) {
+	case VALUE_LIST:
+		return gc_get_refcount(value_list(collection));
+	case VALUE_DICTIONARY:
+		return gc_get_refcount(value_dictionary(collection));
+	case VALUE_RECORD:
+		return gc_get_refcount(value_record(collection));
+	default:
+		fatal_internal("value_holders on something that isn't a collection");
+	}
+}
+
 // :\ Value GC
+
+// : Value copying
+
+// Deep copies a value into the current heap, which is how values move
+// between machines. Nothing in the copy is shared with the original
+// except bytecode and strings' characters (which are never modified)
+// and values that live outside of any heap. Record types copied together keep sharing one
+// canon.
+
+typedef struct {
+	Winter_Canon ** from;
+	Winter_Canon ** to;
+} Copy_Context;
+
+static Value deep_copy(Copy_Context * context, Value value);
+
+static Value deep_copy_element(void * context, Value value)
+{
+	return deep_copy(context, value);
+}
+
+static Winter_Canon * deep_copy_canon(Copy_Context * context, Winter_Canon * canon)
+{
+	for (int i = 0; i < sb_count(context->from); i++) {
+		if (context->from[i] == canon) return context->to[i];
+	}
+	Winter_Canon * copy = current_alloc(sizeof(Winter_Canon), VALUE_TYPE);
+	copy->fields = deep_copy(context, canon->fields);
+	copy->id = canon->id;
+	sb_push(context->from, canon);
+	sb_push(context->to, copy);
+	return copy;
+}
+
+static Value deep_copy(Copy_Context * context, Value value)
+{
+	switch (value.type) {
+	case VALUE_NONE:
+	case VALUE_INTEGER:
+	case VALUE_FLOAT:
+	case VALUE_BOOL:
+	case VALUE_BUILTIN:
+	case VALUE_ISOLATE:
+	case VALUE_CHANNEL:
+		return value;
+	case VALUE_TYPE:
+		if (value._type == VALUE_RECORD) {
+			return value_new_record_type(deep_copy_canon(context, value_canon(value)));
+		}
+		return value;
+	case VALUE_STRING:
+		// Short strings are all in the value, and constants belong to no
+		// heap, so every machine can share them
+		if (value._short || value_string(value)->constant) return value;
+		// The characters never change, so only the header is copied
+		Winter_String * string = value_string(value);
+		return string_sharing(string_buffer(string), string->size, string->hash);
+	case VALUE_FUNCTION: {
+		Function * func = value_function(value);
+		Value copy = value_new_function(func->bytecode);
+		value_function(copy)->pure = func->pure;
+		value_function(copy)->generator = func->generator;
+		value_function(copy)->name = func->name;
+		value_function(copy)->parameter_list = deep_copy(context, func->parameter_list);
+		// A top-level function closes over every global defined before
+		// it, so only the entries the bytecode looks up come along
+		const char ** referenced = NULL;
+		bytecode_referenced_names(func->bytecode, &referenced);
+		for (int i = 0; i < sb_count(referenced); i++) {
+			Value * entry = variable_map_index(&func->closure, referenced[i]);
+			if (!entry) continue;
+			Value closed = deep_copy(context, *entry);
+			// Owned by the closure from now on
+			value_modify_refcount(closed, 1);
+			variable_map_update(&value_function(copy)->closure, referenced[i], closed);
+		}
+		sb_free(referenced);
+		return copy;
+	} break;
+	case VALUE_LIST: {
+		Value copy = value_new_list();
+		for (int i = 0; i < value_list(value)->size; i++) {
+			value_append_list(copy, deep_copy(context, value_list(value)->contents[i]));
+		}
+		return copy;
+	} break;
+	case VALUE_DICTIONARY: {
+		Value copy = value_new_dictionary();
+		Winter_Dictionary * dict = value_dictionary(value);
+		if (dict->shape) {
+			// Shapes are shared by every machine
+			size_t count = dict->shape->count;
+			Winter_Dictionary * to = value_dictionary(copy);
+			to->shape = dict->shape;
+			to->size = count;
+			to->shape_values = malloc(shape_values_capacity(count) * sizeof(Value));
+			for (int i = 0; i < count; i++) {
+				to->shape_values[i] = deep_copy(context, dict->shape_values[i]);
+			}
+			return copy;
+		}
+		for (int i = 0; i < dict->used; i++) {
+			Winter_Dict_Entry * entry = dict->entries + i;
+			if (entry->deleted) continue;
+			value_add_pair_dictionary(copy,
+									  deep_copy(context, entry->key),
+									  deep_copy(context, entry->value));
+		}
+		return copy;
+	} break;
+	case VALUE_VECTOR:
+		return vector_copy(value_vector(value), deep_copy_element, context);
+	case VALUE_MAP:
+		return map_copy(value_map(value), deep_copy_element, context);
+	case VALUE_RECORD: {
+		Value copy = value_new_record(deep_copy_canon(context, value_record(value)->canon));
+		for (int i = 0; i < value_list(value_record(copy)->canon->fields)->size; i++) {
+			value_record(copy)->fields[i] = deep_copy(context, value_record(value)->fields[i]);
+		}
+		return copy;
+	} break;
+	case VALUE_GENERATOR: {
+		Winter_Generator * generator = value_generator(value);
+		if (generator->running) {
+			fatal("Can't copy a running generator");
+		}
+		if (generator->done) {
+			return value_new_generator(NULL);
+		}
+		Call_Frame * from = generator->frame;
+		Call_Frame * frame = call_frame_alloc(from->bytecode);
+		frame->ip = from->ip;
+		frame->name = from->name;
+		frame->loop_stack = sb_copy(from->loop_stack);
+		for (int i = 0; i < sb_count(frame->loop_stack); i++) {
+			Loop * loop = frame->loop_stack + i;
+			if (loop->kind == LOOP_LIST || loop->kind == LOOP_DICTIONARY ||
+				loop->kind == LOOP_VECTOR) {
+				loop->collection = deep_copy(context, loop->collection);
+				value_modify_refcount(loop->collection, 1);
+			}
+			// Points into the old frame's variables
+			loop->var = NULL;
+		}
+		for (int i = 0; i < from->var_map.size; i++) {
+			Value var = deep_copy(context, *from->var_map.values[i]);
+			value_modify_refcount(var, 1);
+			variable_map_update(&frame->var_map, from->var_map.names[i], var);
+		}
+		return value_new_generator(frame);
+	} break;
+	default:
+		fatal_internal("Switch statement in deep_copy not complete");
+	}
+}
+
+Value value_deep_copy(Value value)
+{
+	Copy_Context context = (Copy_Context) { NULL, NULL };
+	Value copy = deep_copy(&context, value);
+	sb_free(context.from);
+	sb_free(context.to);
+	return copy;
+}
+
+// :\ Value copying
@@ -1,5 +1,12 @@
 #include <string.h>
 #include "common.h"
+#include "memprofile.h"
+#include "opstats.h"
+#include "persistent.h"
+#include "profile.h"
+#include "shape.h"
+#include "symbol.h"
+#include "trace.h"
 #include "value.h"
 #include "vm.h"
 
@@ -17,9 +24,6 @@ Variable_Map variable_map_new()
 
 void variable_map_free(Variable_Map map)
 {
-	for (int i = 0; i < sb_count(map.names); i++) {
-		free((void*) map.names[i]);
-	}
 	sb_free(map.names);
 	sb_free(map.values);
 }
@@ -27,10 +31,7 @@ void variable_map_free(Variable_Map map)
 Value * variable_map_index(Variable_Map * map, const char * name)
 {
 	for (int i = 0; i < map->size; i++) {
-		// Can't do string intern comparison because if name is a
-		// function parameter, it's dynamically allocated. Way to fix
-		// this?
-		if (strcmp(name, map->names[i]) == 0) {
+		if (name == map->names[i]) {
 			return map->values[i];
 		}
 	}
@@ -45,7 +46,7 @@ Value * variable_map_update(Variable_Map * map, const char * name, Value value)
 		return index;
 	} else {
 		map->size++;
-		sb_push(map->names, strdup(name));
+		sb_push(map->names, name);
 		Value * storage = malloc(sizeof(Value));
 		*storage = value;
 		sb_push(map->values, storage);
@@ -58,10 +59,7 @@ Variable_Map variable_map_copy(Variable_Map map)
 {
 	Variable_Map nmap = variable_map_new();
 	nmap.size = map.size;
-	nmap.names = NULL;
-	for (int i = 0; i < sb_count(map.names); i++) {
-		sb_push(nmap.names, strdup(map.names[i]));
-	}
+	nmap.names = sb_copy(map.names);
 	nmap.values = sb_copy(map.values);
 	return nmap;
 }
@@ -86,6 +84,8 @@ Call_Frame * call_frame_alloc(BC_Chunk * bytecode)
 	frame->bytecode = bytecode;
 	frame->ip = 0;
 	frame->loop_stack = NULL;
+	frame->generator = NULL;
+	frame->name = NULL;
 	return frame;
 }
 
@@ -95,6 +95,25 @@ void call_frame_free(Call_Frame * frame)
 	variable_map_free(frame->var_map);
 	// Loop stack can't leave function, so that should get freed
 	sb_free(frame->loop_stack);
+	free(frame);
+}
+
+static void loop_release(Loop * loop)
+{
+	if (loop->kind == LOOP_LIST || loop->kind == LOOP_DICTIONARY ||
+		loop->kind == LOOP_VECTOR) {
+		value_modify_refcount(loop->collection, -1);
+	}
+}
+
+void call_frame_release(Call_Frame * frame)
+{
+	for (int i = 0; i < frame->var_map.size; i++) {
+		value_modify_refcount(*frame->var_map.values[i], -1);
+	}
+	for (int i = 0; i < sb_count(frame->loop_stack); i++) {
+		loop_release(frame->loop_stack + i);
+	}
 }
 
 // :\ Call_Frame
@@ -115,7 +134,7 @@ BC_Chunk bc_chunk_new_push(Value value)
 
 BC_Chunk bc_chunk_new_get(const char * name)
 {
-	return (BC_Chunk) { INSTR_GET, .instr_get = (Instr_Get) { name } };
+	return (BC_Chunk) { INSTR_GET, .instr_get = (Instr_Get) { symbol_intern_name(name) } };
 }
 
 BC_Chunk bc_chunk_new_call(size_t arg_count)
@@ -140,15 +159,82 @@ BC_Chunk bc_chunk_new_set_loop(size_t end_offset)
 			.instr_set_loop = (Instr_Set_Loop) { end_offset } };
 }
 
-BC_Chunk bc_chunk_new_create_function(size_t parameter_count, BC_Chunk * bytecode)
+BC_Chunk bc_chunk_new_set_iter(size_t end_offset)
+{
+	return (BC_Chunk) { INSTR_SET_ITER,
+			.instr_set_loop = (Instr_Set_Loop) { end_offset } };
+}
+
+BC_Chunk bc_chunk_new_set_range(size_t end_offset)
+{
+	return (BC_Chunk) { INSTR_SET_RANGE,
+			.instr_set_loop = (Instr_Set_Loop) { end_offset } };
+}
+
+BC_Chunk bc_chunk_new_for_iter(const char * name)
+{
+	return (BC_Chunk) { INSTR_FOR_ITER,
+			.instr_for_iter = (Instr_For_Iter) { symbol_intern_name(name) } };
+}
+
+// The cache lives as long as the bytecode does: the rest of the
+// process for function bodies, until bc_unit_free for top-level units
+BC_Chunk bc_chunk_new_field(enum Instruction instr, const char * name)
+{
+	internal_assert(instr == INSTR_GET_FIELD || instr == INSTR_ASSIGN_FIELD ||
+					instr == INSTR_INDEX_KEY || instr == INSTR_ASSIGN_KEY);
+	Field_Cache * cache = calloc(1, sizeof(Field_Cache));
+	Value key = symbol_intern(name);
+	return (BC_Chunk) {
+		instr, .instr_field = (Instr_Field) { value_string(key)->contents, key, cache }
+	};
+}
+
+void bc_unit_free(BC_Chunk * bytecode)
+{
+	for (size_t i = 0; i < sb_count(bytecode); i++) {
+		switch (bytecode[i].instr) {
+		case INSTR_GET_FIELD:
+		case INSTR_ASSIGN_FIELD:
+		case INSTR_INDEX_KEY:
+		case INSTR_ASSIGN_KEY:
+			free(bytecode[i].instr_field.cache);
+			break;
+		default:
+			break;
+		}
+	}
+	sb_free(bytecode);
+}
+
+void bytecode_referenced_names(BC_Chunk * bytecode, const char *** names)
+{
+	for (size_t i = 0; i < sb_count(bytecode); i++) {
+		if (bytecode[i].instr == INSTR_GET) {
+			const char * name = bytecode[i].instr_get.name;
+			bool seen = false;
+			for (int j = 0; j < sb_count(*names); j++) {
+				if ((*names)[j] == name) seen = true;
+			}
+			if (!seen) sb_push(*names, name);
+		} else if (bytecode[i].instr == INSTR_CREATE_FUNCTION) {
+			bytecode_referenced_names(bytecode[i].instr_create_function.bytecode, names);
+		}
+	}
+}
+
+BC_Chunk bc_chunk_new_create_function(size_t parameter_count, BC_Chunk * bytecode,
+									  bool generator, const char * name)
 {
-	Instr_Create_Function instr = (Instr_Create_Function) { parameter_count, bytecode };
+	Instr_Create_Function instr = (Instr_Create_Function) {
+		parameter_count, bytecode, generator, name
+	};
 	return (BC_Chunk) { INSTR_CREATE_FUNCTION, .instr_create_function = instr };
 }
 
 BC_Chunk bc_chunk_new_create_string(const char * literal)
 {
-	Instr_Create_String instr = (Instr_Create_String) { literal };
+	Instr_Create_String instr = (Instr_Create_String) { symbol_intern(literal) };
 	return (BC_Chunk) { INSTR_CREATE_STRING, .instr_create_string = instr };
 }
 
@@ -158,45 +244,56 @@ BC_Chunk bc_chunk_new_create_type_canon(size_t field_count)
 	return (BC_Chunk) { INSTR_CREATE_TYPE_CANON, .instr_create_type_canon = instr };
 }
 
+const char * instr_names[NUM_INSTRUCTIONS] = {
+	[INSTR_NOP] = "NOP",
+	[INSTR_RETURN] = "RETURN",
+	[INSTR_POP] = "POP",
+	[INSTR_LOOP_END] = "LOOP_END",
+	[INSTR_BREAK] = "BREAK",
+	[INSTR_CONTINUE] = "CONTINUE",
+	[INSTR_CLOSURE] = "CLOSURE",
+	[INSTR_APPEND] = "APPEND",
+	[INSTR_CAST] = "CAST",
+	[INSTR_BIND] = "BIND",
+	[INSTR_INDEX_ASSIGN] = "INDEX_ASSIGN",
+	[INSTR_ADD_PAIR] = "ADD_PAIR",
+	[INSTR_GET_FIELD] = "GET_FIELD",
+	[INSTR_ASSIGN_FIELD] = "ASSIGN_FIELD",
+	[INSTR_INDEX_KEY] = "INDEX_KEY",
+	[INSTR_ASSIGN_KEY] = "ASSIGN_KEY",
+	[INSTR_YIELD] = "YIELD",
+
+	[INSTR_NEGATE] = "NEGATE",
+	[INSTR_ADD] = "ADD",
+	[INSTR_MULT] = "MULT",
+	[INSTR_DIV] = "DIV",
+	[INSTR_NOT] = "NOT",
+	[INSTR_EQ] = "EQ",
+	[INSTR_GT] = "GT",
+	[INSTR_LT] = "LT",
+	[INSTR_AND] = "AND",
+	[INSTR_OR] = "OR",
+	[INSTR_INDEX] = "INDEX",
+
+	[INSTR_PUSH] = "PUSH",
+	[INSTR_GET] = "GET",
+	[INSTR_CALL] = "CALL",
+	[INSTR_JUMP] = "JUMP",
+	[INSTR_CONDJUMP] = "CONDJUMP",
+	[INSTR_SET_LOOP] = "SET_LOOP",
+	[INSTR_SET_ITER] = "SET_ITER",
+	[INSTR_SET_RANGE] = "SET_RANGE",
+	[INSTR_FOR_ITER] = "FOR_ITER",
+
+	[INSTR_CREATE_FUNCTION] = "CREATE_FUNCTION",
+	[INSTR_CREATE_LIST] = "CREATE_LIST",
+	[INSTR_CREATE_STRING] = "CREATE_STRING",
+	[INSTR_CREATE_DICTIONARY] = "CREATE_DICTIONARY",
+	[INSTR_CREATE_TYPE_CANON] = "CREATE_TYPE_CANON",
+};
+
 void bc_chunk_print(BC_Chunk chunk)
 {
-	const char * instr_names[] = {	
-		[INSTR_NOP] = "NOP",
-		[INSTR_RETURN] = "RETURN",
-		[INSTR_POP] = "POP",
-		[INSTR_LOOP_END] = "LOOP_END",
-		[INSTR_BREAK] = "BREAK",
-		[INSTR_CONTINUE] = "CONTINUE",
-		[INSTR_CLOSURE] = "CLOSURE",
-		[INSTR_APPEND] = "APPEND",
-		[INSTR_CAST] = "CAST",
-
-		[INSTR_NEGATE] = "NEGATE",
-		[INSTR_ADD] = "ADD",
-		[INSTR_MULT] = "MULT",
-		[INSTR_DIV] = "DIV",
-		[INSTR_NOT] = "NOT",
-		[INSTR_EQ] = "EQ",
-		[INSTR_GT] = "GT",
-		[INSTR_LT] = "LT",
-		[INSTR_AND] = "AND",
-		[INSTR_OR] = "OR",
-		[INSTR_INDEX] = "INDEX",
-		
-		[INSTR_PUSH] = "PUSH",
-		[INSTR_BIND] = "BIND",
-		[INSTR_GET] = "GET",
-		[INSTR_CALL] = "CALL",
-		[INSTR_JUMP] = "JUMP",
-		[INSTR_CONDJUMP] = "CONDJUMP",
-		[INSTR_SET_LOOP] = "SET_LOOP",
-
-		[INSTR_CREATE_FUNCTION] = "CREATE_FUNCTION",
-		[INSTR_CREATE_LIST] = "CREATE_LIST",
-		[INSTR_CREATE_STRING] = "CREATE_STRING",
-		[INSTR_CREATE_DICTIONARY] = "CREATE_DICTIONARY",
-	};
-
 	#if DEBUG_PRINTS
 	printf("%s: ", instr_names[chunk.instr]);
 	switch (chunk.instr) {
@@ -206,6 +303,12 @@ void bc_chunk_print(BC_Chunk chunk)
 	case INSTR_GET:
 		printf("%s\n", chunk.instr_get.name);
 		break;
+	case INSTR_GET_FIELD:
+	case INSTR_ASSIGN_FIELD:
+	case INSTR_INDEX_KEY:
+	case INSTR_ASSIGN_KEY:
+		printf("%s\n", chunk.instr_field.name);
+		break;
 	case INSTR_CALL:
 		printf("%d\n", chunk.instr_call.arg_count);
 		break;
@@ -229,6 +332,21 @@ void bc_chunk_print(BC_Chunk chunk)
 
 // :\ Value Refcount
 
+// : Fiber
+
+static void fiber_free(Fiber * fiber)
+{
+	for (int i = 0; i < sb_count(fiber->call_stack); i++) {
+		call_frame_free(fiber->call_stack[i]);
+	}
+	sb_free(fiber->call_stack);
+	sb_free(fiber->eval_stack);
+	sb_free(fiber->bytecode);
+	free(fiber);
+}
+
+// :\ Fiber
+
 // : Winter_Machine
 
 Winter_Machine * winter_machine_alloc()
@@ -236,12 +354,45 @@ Winter_Machine * winter_machine_alloc()
 	Winter_Machine * wm = malloc(sizeof(Winter_Machine));
 	wm->eval_stack = NULL;
 	wm->call_stack = NULL;
-	sb_push(wm->call_stack, call_frame_alloc(NULL));
+	wm->global_frame = call_frame_alloc(NULL);
+	sb_push(wm->call_stack, wm->global_frame);
 	wm->running = false;
+	wm->fibers = NULL;
+	wm->fiber_head = 0;
+	wm->main_fiber = malloc(sizeof(Fiber));
+	wm->main_fiber->bytecode = NULL;
+	wm->fiber = wm->main_fiber;
+	wm->switch_fiber = false;
+	wm->blocked = false;
+	wm->wait_fd = -1;
+	wm->reactor = reactor_new();
+	wm->gc = gc_new();
+	gc_make_current(&wm->gc);
 	wm->cycles_since_collection = 0;
+	wm->op_stats = NULL;
 	return wm;
 }
 
+void winter_machine_free(Winter_Machine * wm)
+{
+	wm->fiber->call_stack = wm->call_stack;
+	wm->fiber->eval_stack = wm->eval_stack;
+	fiber_free(wm->fiber);
+	for (int i = wm->fiber_head; i < sb_count(wm->fibers); i++) {
+		fiber_free(wm->fibers[i]);
+	}
+	sb_free(wm->fibers);
+	for (int i = 0; i < sb_count(wm->reactor.waiters); i++) {
+		Reactor_Waiters * waiters = wm->reactor.waiters + i;
+		for (int j = 0; j < sb_count(waiters->fibers); j++) {
+			fiber_free(waiters->fibers[j]);
+		}
+	}
+	reactor_free(&wm->reactor);
+	gc_free(&wm->gc);
+	free(wm);
+}
+
 Value winter_machine_pop(Winter_Machine * wm)
 {
 	internal_assert(sb_count(wm->eval_stack) > 0);
@@ -274,8 +425,96 @@ void winter_machine_pop_call_stack(Winter_Machine * wm)
 
 Call_Frame * winter_machine_global_frame(Winter_Machine * wm)
 {
-	internal_assert(sb_count(wm->call_stack) > 0);
-	return wm->call_stack[0];
+	return wm->global_frame;
+}
+
+static size_t winter_machine_runnable_fibers(Winter_Machine * wm)
+{
+	return sb_count(wm->fibers) - wm->fiber_head;
+}
+
+size_t winter_machine_waiting_fibers(Winter_Machine * wm)
+{
+	return winter_machine_runnable_fibers(wm) + wm->reactor.parked;
+}
+
+void winter_machine_wait_fd(Winter_Machine * wm, int fd, uint32_t events)
+{
+	wm->blocked = true;
+	wm->wait_fd = fd;
+	wm->wait_events = events;
+}
+
+typedef enum {
+	// Back of the queue
+	SWITCH_YIELD,
+	// Handed to the reactor
+	SWITCH_WAIT,
+	// Done, so freed
+	SWITCH_FINISH,
+} Fiber_Switch;
+
+// Sets the running fiber aside and resumes the one that has waited
+// longest, first waking any whose fds are ready. If nothing can run,
+// waits for the reactor to wake something.
+void winter_machine_switch_fiber(Winter_Machine * wm, Fiber_Switch how)
+{
+	Fiber * from = wm->fiber;
+	from->call_stack = wm->call_stack;
+	from->eval_stack = wm->eval_stack;
+	switch (how) {
+	case SWITCH_YIELD:
+		sb_push(wm->fibers, from);
+		break;
+	case SWITCH_WAIT:
+		break;
+	case SWITCH_FINISH:
+		fiber_free(from);
+		break;
+	}
+
+	bool idle = winter_machine_runnable_fibers(wm) == 0;
+	double wait_start = idle && tracing(wm) ? trace_now() : 0;
+	reactor_wait(&wm->reactor, &wm->fibers, idle ? -1 : 0);
+	internal_assert(winter_machine_runnable_fibers(wm) > 0);
+
+	Fiber * to = wm->fibers[wm->fiber_head++];
+	// Keep the queue from creeping along forever
+	size_t runnable = winter_machine_runnable_fibers(wm);
+	if (wm->fiber_head >= 64 && wm->fiber_head >= runnable) {
+		memmove(wm->fibers, wm->fibers + wm->fiber_head, sizeof(Fiber*) * runnable);
+		stb__sbn(wm->fibers) = runnable;
+		wm->fiber_head = 0;
+	}
+
+	wm->fiber = to;
+	wm->call_stack = to->call_stack;
+	if (idle && tracing(wm)) {
+		// Shown on the fiber that woke up
+		trace_span(wm, "wait for I/O", "io", wait_start);
+	}
+	wm->eval_stack = to->eval_stack;
+}
+
+void winter_machine_go(Winter_Machine * wm, Value func,
+					   Value * args, size_t arg_count, Assoc_Source assoc)
+{
+	Fiber * fiber = malloc(sizeof(Fiber));
+	fiber->bytecode = NULL;
+	sb_push(fiber->bytecode, bc_chunk_new_call(arg_count));
+	sb_last(fiber->bytecode).assoc = assoc;
+	sb_push(fiber->bytecode, bc_chunk_new_no_args(INSTR_POP));
+	sb_last(fiber->bytecode).assoc = assoc;
+	fiber->call_stack = NULL;
+	sb_push(fiber->call_stack, call_frame_alloc(fiber->bytecode));
+	fiber->eval_stack = NULL;
+	for (int i = 0; i < arg_count; i++) {
+		sb_push(fiber->eval_stack, args[i]);
+		value_modify_refcount(args[i], 1);
+	}
+	sb_push(fiber->eval_stack, func);
+	value_modify_refcount(func, 1);
+	sb_push(wm->fibers, fiber);
 }
 
 Call_Frame * winter_machine_frame(Winter_Machine * wm)
@@ -295,30 +534,138 @@ void winter_machine_print_eval_stack(Winter_Machine * wm)
 
 void winter_machine_return(Winter_Machine * wm)
 {
-	// Decrease reference count for every variable in varmap
 	Call_Frame * frame = winter_machine_frame(wm);
-	for (int i = 0; i < frame->var_map.size; i++) {
-		value_modify_refcount(*frame->var_map.values[i], -1);
+	if (frame->generator) {
+		// Finished for good
+		Winter_Generator * generator = frame->generator;
+		generator->frame = NULL;
+		generator->running = false;
+		generator->done = true;
+		gc_modify_refcount(generator, -1);
 	}
+	call_frame_release(frame);
+	if (tracing(wm)) trace_exit(wm);
 	// Pop call stack
 	winter_machine_pop_call_stack(wm);
 }
 
+// : Field_Cache
+
+static int field_cache_find(Field_Cache * cache, uint64_t id)
+{
+	for (int i = 0; i < FIELD_CACHE_SIZE; i++) {
+		uint64_t entry = atomic_load_explicit(&cache->entries[i], memory_order_relaxed);
+		if (entry == 0) break;
+		if (entry >> FIELD_CACHE_SLOT_BITS == id) {
+			return entry & ((1 << FIELD_CACHE_SLOT_BITS) - 1);
+		}
+	}
+	return -1;
+}
+
+// Misses remember the slot in the first free entry. Once all are taken
+// the access is megamorphic, and later ids are always looked up by name.
+static void field_cache_fill(Field_Cache * cache, uint64_t id, int slot)
+{
+	if (slot >= (1 << FIELD_CACHE_SLOT_BITS) || id >> (64 - FIELD_CACHE_SLOT_BITS) != 0) {
+		return;
+	}
+	uint64_t entry = id << FIELD_CACHE_SLOT_BITS | slot;
+	for (int i = 0; i < FIELD_CACHE_SIZE; i++) {
+		uint64_t empty = 0;
+		// Another thread may have got here first with the same id,
+		// which only wastes an entry
+		if (atomic_compare_exchange_strong_explicit(&cache->entries[i], &empty, entry,
+													memory_order_relaxed,
+													memory_order_relaxed)) {
+			break;
+		}
+	}
+}
+
+static Value * record_field(Value record, Instr_Field instr, Assoc_Source assoc)
+{
+	if (record.type != VALUE_RECORD) {
+		fatal_assoc(assoc, "Can't get field from non-record");
+	}
+	Winter_Canon * canon = value_record(record)->canon;
+	int slot = field_cache_find(instr.cache, canon->id);
+	if (slot == -1) {
+		slot = value_record_field_index(canon, instr.name);
+		if (slot == -1) {
+			fatal_assoc(assoc, "Field does not exist");
+		}
+		field_cache_fill(instr.cache, canon->id, slot);
+	}
+	return value_record(record)->fields + slot;
+}
+
+// The value under a string literal key, if the collection is a shaped
+// dictionary that has it. Anything else takes the generic path.
+static Value * shaped_key(Value collection, Instr_Field instr)
+{
+	if (collection.type != VALUE_DICTIONARY) return NULL;
+	Winter_Dictionary * dict = value_dictionary(collection);
+	if (!dict->shape) return NULL;
+	int slot = field_cache_find(instr.cache, dict->shape->id);
+	if (slot == -1) {
+		slot = shape_find_symbol(dict->shape, instr.name);
+		if (slot == -1) return NULL;
+		field_cache_fill(instr.cache, dict->shape->id, slot);
+	}
+	return dict->shape_values + slot;
+}
+
+// :\ Field_Cache
+
+// Popping released the value, but everything holding the collection
+// holds it now, and stops holding whatever was there before
+static void replace_element(Value collection, Value * element, Value value)
+{
+	int32_t holders = value_holders(collection);
+	value_modify_refcount(value, holders);
+	value_modify_refcount(*element, -holders);
+	*element = value;
+}
+
+static void index_assign(Value collection, Value index, Value value, Assoc_Source assoc)
+{
+	if (collection.type == VALUE_DICTIONARY) {
+		// Dictionaries are unique in that a failed lookup will
+		// result in adding a new item
+		Value * element = value_index_dictionary(collection, index);
+		if (element) {
+			replace_element(collection, element, value);
+		} else {
+			value_add_pair_dictionary(collection, index, value);
+			int32_t holders = value_holders(collection);
+			value_modify_refcount(value, holders);
+			// Shaped dictionaries keep their keys in the shape
+			if (!value_dictionary(collection)->shape) value_modify_refcount(index, holders);
+		}
+	} else {
+		replace_element(collection, value_mutable_index(collection, index, assoc), value);
+	}
+}
+
 void winter_machine_step(Winter_Machine * wm)
 {
 	dbprintf("\n");
 	
-	if (winter_machine_reached_end(wm)) {
+	while (wm->running && winter_machine_reached_end(wm)) {
 		internal_assert(sb_count(wm->call_stack) > 0);
-		if (sb_count(wm->call_stack) == 1) {
-			// Not in function
-			// Reached end of provided statement
-			wm->running = false;
-		} else {
+		if (sb_count(wm->call_stack) > 1) {
 			// In function
 			// Inferred return, return and push none to the eval stack
 			push(value_none());
 			winter_machine_return(wm);
+		} else if (wm->fiber != wm->main_fiber) {
+			// Fiber finished
+			winter_machine_switch_fiber(wm, SWITCH_FINISH);
+		} else {
+			// Not in function
+			// Reached end of provided statement
+			wm->running = false;
 		}
 	}
 
@@ -330,6 +677,16 @@ void winter_machine_step(Winter_Machine * wm)
 		chunk = this_frame->bytecode[this_frame->ip++];
 	}
 
+	if (profile_due(wm)) profile_sample(wm, chunk);
+	if (wm->op_stats) op_stats_count(wm->op_stats, chunk.instr);
+	if (wm->gc.profile) {
+		wm->gc.site = chunk.assoc;
+		if (alloc_profile_requested) {
+			alloc_profile_requested = 0;
+			alloc_profile_report(wm->gc.profile);
+		}
+	}
+
 	bc_chunk_print(chunk);
 	dbprintf("...\n");
 	//dbprintf("! ! ! Executing line %d\n", chunk.assoc.line);
@@ -361,6 +718,7 @@ void winter_machine_step(Winter_Machine * wm)
 			fatal_assoc(chunk.assoc, "Can't use break in non-loop");
 		}
 		Loop loop = sb_pop(frame->loop_stack);
+		loop_release(&loop);
 		frame->ip = loop.end;
 	} break;
 	case INSTR_CONTINUE: {
@@ -376,7 +734,7 @@ void winter_machine_step(Winter_Machine * wm)
 		if (value.type != VALUE_FUNCTION) {
 			fatal_internal("Tried to close on something that's not a function");
 		}
-		Function * function = value._function;
+		Function * function = value_function(value);
 		function->closure = variable_map_copy(winter_machine_frame(wm)->var_map);
 		push(value);
 	} break;
@@ -393,7 +751,7 @@ void winter_machine_step(Winter_Machine * wm)
 			fatal_assoc(chunk.assoc, "Can't cast to non-type");
 		}
 		Value to_cast = pop();
-		push(value_cast(to_cast, type._type.type, chunk.assoc));
+		push(value_cast(to_cast, type._type, chunk.assoc));
 	} break;
 	case INSTR_BIND: {
 		Value name = pop();
@@ -403,26 +761,13 @@ void winter_machine_step(Winter_Machine * wm)
 		value_modify_refcount(value, 1);
 		
 		Variable_Map * varmap = &(winter_machine_frame(wm)->var_map);
-		variable_map_update(varmap, name._string.contents, value);
+		variable_map_update(varmap, value_string(name)->contents, value);
 	} break;
 	case INSTR_INDEX_ASSIGN: {
 		Value index = pop();
 		Value collection = pop();
 		Value value = pop();
-		if (collection.type == VALUE_DICTIONARY) {
-			// Dictionaries are unique in that a failed lookup will
-			// result in adding a new item
-			Value * element = value_index_dictionary(collection, index);
-			if (element) {
-				*element = value;
-			} else {
-				value_add_pair_dictionary(collection, index, value);
-			}
-		} else {
-			Value * element = value_mutable_index(collection, index, chunk.assoc);
-			*element = value;
-		}
-		push(collection);
+		index_assign(collection, index, value, chunk.assoc);
 	} break;
 	case INSTR_ADD_PAIR: {
 		Value value = pop();
@@ -431,32 +776,18 @@ void winter_machine_step(Winter_Machine * wm)
 		value_add_pair(dict, key, value, chunk.assoc);
 		push(dict);
 	} break;
-	case INSTR_GET_FIELD: {
-		Value field = pop();
-		internal_assert(field.type == VALUE_STRING);
-		Value record = pop();
-		if (record.type != VALUE_RECORD) {
-			fatal_assoc(chunk.assoc, "Can't get field from non-record");
-		}
-		Value * val = value_index_dictionary(record._record->field_dict, field);
-		if (!val) {
-			fatal_assoc(chunk.assoc, "Field does not exist");
-		}
-		push(*val);
-	} break;
-	case INSTR_ASSIGN_FIELD: {
-		Value field = pop();
-		internal_assert(field.type == VALUE_STRING);
-		// TODO(pixlark): cutnpaste from GET_FIELD
-		Value record = pop();
-		if (record.type != VALUE_RECORD) {
-			fatal_assoc(chunk.assoc, "Can't get field from non-record");
-		}
-		Value * val = value_index_dictionary(record._record->field_dict, field);
-		if (!val) {
-			fatal_assoc(chunk.assoc, "Field does not exist");
+	case INSTR_YIELD: {
+		Call_Frame * frame = winter_machine_frame(wm);
+		if (!frame->generator) {
+			fatal_assoc(chunk.assoc, "Can't yield outside of a generator");
 		}
-		*val = pop();
+		Value value = pop();
+		// Suspend the frame, keeping its variables alive
+		if (tracing(wm)) trace_exit(wm);
+		sb_pop(wm->call_stack);
+		frame->generator->running = false;
+		gc_modify_refcount(frame->generator, -1);
+		push(value);
 	} break;
 
 		// Operations
@@ -536,26 +867,56 @@ void winter_machine_step(Winter_Machine * wm)
 		Value func_val = pop();
 		Instr_Call instr = chunk.instr_call;
 		if (func_val.type == VALUE_FUNCTION) {
-			Function func = *(func_val._function);
+			Function func = *(value_function(func_val));
 			internal_assert(func.parameter_list.type == VALUE_LIST);
-			Winter_List * parameters = func.parameter_list._list;
+			Winter_List * parameters = value_list(func.parameter_list);
 			if (parameters->size != instr.arg_count) {
 				fatal_assoc(chunk.assoc, "Expected %d arguments, got %d", parameters->size, instr.arg_count);
 			}
 			Call_Frame * frame = call_frame_alloc(func.bytecode);
+			frame->name = func.name;
 			// Start off varmap with closure
 			frame->var_map = variable_map_copy(func.closure);
 			// Push arguments into varmap
 			for (int i = parameters->size - 1; i >= 0; i--) {
 				Value arg = pop();
 				internal_assert(parameters->contents[i].type == VALUE_STRING);
-				variable_map_update(&(frame->var_map), parameters->contents[i]._string.contents, arg);
+				variable_map_update(&(frame->var_map), value_string(parameters->contents[i])->contents, arg);
 			}
 			// Bump refcount for all variables in new varmap
 			for (int i = 0; i < frame->var_map.size; i++) {
 				value_modify_refcount(*frame->var_map.values[i], 1);
 			}
-			sb_push(wm->call_stack, frame);	
+			if (func.generator) {
+				// Doesn't run until the first next()
+				push(value_new_generator(frame));
+			} else {
+				sb_push(wm->call_stack, frame);
+				if (tracing(wm)) trace_enter(wm, func.name);
+			}
+		} else if (func_val.type == VALUE_BUILTIN && func_val._builtin == BUILTIN_NEXT) {
+			// Resuming a generator pushes its frame, so it has to
+			// happen here rather than in a builtin
+			if (instr.arg_count != 1) {
+				fatal_assoc(chunk.assoc, "Wrong number of arguments to builtin function next");
+			}
+			Value generator_val = pop();
+			if (generator_val.type != VALUE_GENERATOR) {
+				fatal_assoc(chunk.assoc, "next requires a generator");
+			}
+			Winter_Generator * generator = value_generator(generator_val);
+			if (generator->running) {
+				fatal_assoc(chunk.assoc, "Generator is already running");
+			}
+			if (generator->done) {
+				push(value_none());
+			} else {
+				// The frame on the call stack keeps the generator alive
+				generator->running = true;
+				gc_modify_refcount(generator, 1);
+				sb_push(wm->call_stack, generator->frame);
+				if (tracing(wm)) trace_enter(wm, generator->frame->name);
+			}
 		} else if (func_val.type == VALUE_BUILTIN) {
 			Builtin builtin = func_val._builtin;
 			if (builtin_arg_counts[builtin] != -1) {
@@ -568,23 +929,35 @@ void winter_machine_step(Winter_Machine * wm)
 			for (int i = 0; i < instr.arg_count; i++) {
 				args[instr.arg_count - i - 1] = pop();
 			}
-			Value ret = builtin_functions[builtin](args, instr.arg_count, chunk.assoc);
+			bool trace_call = builtin_blocking[builtin] && tracing(wm);
+			double call_start = trace_call ? trace_now() : 0;
+			Value ret = builtin_functions[builtin](wm, args, instr.arg_count, chunk.assoc);
+			if (trace_call) trace_span(wm, builtin_names[builtin], "builtin", call_start);
+			if (wm->blocked) {
+				// Put the call back the way it was and let other
+				// fibers run until it can go through
+				wm->blocked = false;
+				for (int i = 0; i < instr.arg_count; i++) {
+					push(args[i]);
+				}
+				push(func_val);
+				winter_machine_frame(wm)->ip--;
+				wm->switch_fiber = true;
+			} else {
+				push(ret);
+			}
 			free(args);
-			push(ret);
 		} else if (func_val.type == VALUE_TYPE) {
-			if (func_val._type.type != VALUE_RECORD) {
+			if (func_val._type != VALUE_RECORD) {
 				fatal_assoc(chunk.assoc, "Can't construct non-record");
 			}
-			Value record = value_new_record(func_val._type.canon);
-			if (instr.arg_count > func_val._type.canon->fields._list->size) {
+			Value record = value_new_record(value_canon(func_val));
+			if (instr.arg_count > value_list(value_canon(func_val)->fields)->size) {
 				fatal_assoc(chunk.assoc, "Too many arguments for record initialization");
 			}
+			// Arguments go to fields in declaration order
 			for (int i = instr.arg_count - 1; i >= 0; i--) {
-				Value value = pop();
-				Value s = value_cast(value, VALUE_STRING, (Assoc_Source) {0});
-				Value * spot = value_index_dictionary(record._record->field_dict,
-													  func_val._type.canon->fields._list->contents[i]);
-				*spot = value;
+				value_record(record)->fields[i] = pop();
 			}
 			push(record);
 		} else {
@@ -610,6 +983,141 @@ void winter_machine_step(Winter_Machine * wm)
 		Call_Frame * frame = winter_machine_frame(wm);
 		Loop new_loop = (Loop) { frame->ip, frame->ip + instr.end_offset };
 		sb_push(frame->loop_stack, new_loop);
+	} break;
+	case INSTR_SET_ITER: {
+		Instr_Set_Loop instr = chunk.instr_set_loop;
+		Call_Frame * frame = winter_machine_frame(wm);
+		Value collection = pop();
+		Loop new_loop = (Loop) { frame->ip, frame->ip + instr.end_offset };
+		if (collection.type == VALUE_LIST) {
+			new_loop.kind = LOOP_LIST;
+		} else if (collection.type == VALUE_DICTIONARY) {
+			new_loop.kind = LOOP_DICTIONARY;
+		} else if (collection.type == VALUE_VECTOR) {
+			new_loop.kind = LOOP_VECTOR;
+		} else if (collection.type == VALUE_MAP) {
+			// The map can't change, so looping over a list of its
+			// keys is the same
+			new_loop.kind = LOOP_LIST;
+			collection = map_keys(value_map(collection));
+		} else {
+			fatal_assoc(chunk.assoc, "Can't iterate over %s",
+						value_type_names[collection.type]);
+		}
+		new_loop.collection = collection;
+		value_modify_refcount(collection, 1);
+		sb_push(frame->loop_stack, new_loop);
+	} break;
+	case INSTR_SET_RANGE: {
+		Instr_Set_Loop instr = chunk.instr_set_loop;
+		Call_Frame * frame = winter_machine_frame(wm);
+		Value step = pop();
+		Value stop = pop();
+		Value start = pop();
+		if (start.type != VALUE_INTEGER || stop.type != VALUE_INTEGER ||
+			step.type != VALUE_INTEGER) {
+			fatal_assoc(chunk.assoc, "range requires integers");
+		}
+		if (step._integer == 0) {
+			fatal_assoc(chunk.assoc, "range step can't be zero");
+		}
+		Loop new_loop = (Loop) { frame->ip, frame->ip + instr.end_offset };
+		new_loop.kind = LOOP_RANGE;
+		new_loop.counter = start._integer;
+		new_loop.stop = stop._integer;
+		new_loop.step = step._integer;
+		sb_push(frame->loop_stack, new_loop);
+	} break;
+	case INSTR_GET_FIELD: {
+		Value record = pop();
+		push(*record_field(record, chunk.instr_field, chunk.assoc));
+	} break;
+	case INSTR_ASSIGN_FIELD: {
+		Value record = pop();
+		Value * val = record_field(record, chunk.instr_field, chunk.assoc);
+		replace_element(record, val, pop());
+	} break;
+	case INSTR_INDEX_KEY: {
+		Value collection = pop();
+		Value * element = shaped_key(collection, chunk.instr_field);
+		if (element) {
+			push(*element);
+		} else {
+			push(value_index(collection, chunk.instr_field.key, chunk.assoc));
+		}
+	} break;
+	case INSTR_ASSIGN_KEY: {
+		Value collection = pop();
+		Value value = pop();
+		Value * element = shaped_key(collection, chunk.instr_field);
+		if (element) {
+			replace_element(collection, element, value);
+		} else {
+			index_assign(collection, chunk.instr_field.key, value, chunk.assoc);
+		}
+	} break;
+	case INSTR_FOR_ITER: {
+		Instr_For_Iter instr = chunk.instr_for_iter;
+		Call_Frame * frame = winter_machine_frame(wm);
+		internal_assert(sb_count(frame->loop_stack) > 0);
+		Loop * loop = &sb_last(frame->loop_stack);
+		// Find the next element, or leave the loop
+		Value element;
+		bool exhausted;
+		switch (loop->kind) {
+		case LOOP_RANGE:
+			exhausted = loop->step > 0
+				? loop->counter >= loop->stop
+				: loop->counter <= loop->stop;
+			if (!exhausted) {
+				element = value_new_integer(loop->counter);
+				loop->counter += loop->step;
+			}
+			break;
+		// Index every time, since the body is free to change the
+		// collection's size
+		case LOOP_LIST: {
+			Winter_List * list = value_list(loop->collection);
+			exhausted = loop->counter >= list->size;
+			if (!exhausted) {
+				element = list->contents[loop->counter++];
+			}
+		} break;
+		case LOOP_DICTIONARY: {
+			Winter_Dictionary * dict = value_dictionary(loop->collection);
+			while (loop->counter < dictionary_end(dict) &&
+				   !dictionary_value(dict, loop->counter)) {
+				loop->counter++;
+			}
+			exhausted = loop->counter >= dictionary_end(dict);
+			if (!exhausted) {
+				element = dictionary_key(dict, loop->counter++);
+			}
+		} break;
+		case LOOP_VECTOR: {
+			Winter_Vector * vector = value_vector(loop->collection);
+			exhausted = loop->counter >= vector->count;
+			if (!exhausted) {
+				element = *vector_index(vector, loop->counter++);
+			}
+		} break;
+		default:
+			fatal_internal("FOR_ITER executed in a plain loop");
+		}
+		if (exhausted) {
+			Loop finished = sb_pop(frame->loop_stack);
+			loop_release(&finished);
+			frame->ip = finished.end;
+			break;
+		}
+		// Bind like BIND would, but keep the storage around so later
+		// iterations skip the name lookup
+		value_modify_refcount(element, 1);
+		if (loop->var) {
+			*loop->var = element;
+		} else {
+			loop->var = variable_map_update(&frame->var_map, instr.name, element);
+		}
 	} break;
 		// Creation of dynamically allocated values
 	case INSTR_CREATE_FUNCTION: {
@@ -621,7 +1129,9 @@ void winter_machine_step(Winter_Machine * wm)
 			value_append_list(parameter_list, parameter);
 		}
 		Value func = value_new_function(instr.bytecode);
-		func._function->parameter_list = parameter_list;
+		value_function(func)->parameter_list = parameter_list;
+		value_function(func)->generator = instr.generator;
+		value_function(func)->name = instr.name;
 		push(func);
 	} break;
 	case INSTR_CREATE_LIST: {
@@ -629,9 +1139,7 @@ void winter_machine_step(Winter_Machine * wm)
 		push(list);
 	} break;
 	case INSTR_CREATE_STRING: {
-		Instr_Create_String instr = chunk.instr_create_string;
-		Value string = value_new_string(instr.literal);
-		push(string);
+		push(chunk.instr_create_string.string);
 	} break;
 	case INSTR_CREATE_DICTIONARY: {
 		Value dict = value_new_dictionary();
@@ -645,11 +1153,8 @@ void winter_machine_step(Winter_Machine * wm)
 			internal_assert(field_name.type == VALUE_STRING);
 			value_append_list(fields, field_name);
 		}
-		Winter_Canon * canon = global_alloc(sizeof(Winter_Canon));
-		canon->fields = fields;
-		Value type_value = value_new_type(VALUE_RECORD);
-		type_value._type.canon = canon;
-		push(type_value);
+		Winter_Canon * canon = value_new_canon(fields);
+		push(value_new_record_type(canon));
 	} break;
 	default:
 		fatal_internal("Nonexistent instruction reached winter_machine_step()");
@@ -662,10 +1167,29 @@ void winter_machine_step(Winter_Machine * wm)
 	dbprintf("-- Var Map --\n");
 	variable_map_print(sb_last(wm->call_stack)->var_map);
 	
+	if (wm->switch_fiber) {
+		wm->switch_fiber = false;
+		if (wm->wait_fd != -1) {
+			reactor_park(&wm->reactor, wm->wait_fd, wm->wait_events, wm->fiber, chunk.assoc);
+			wm->wait_fd = -1;
+			winter_machine_switch_fiber(wm, SWITCH_WAIT);
+		} else if (winter_machine_waiting_fibers(wm) > 0) {
+			winter_machine_switch_fiber(wm, SWITCH_YIELD);
+		}
+	}
+
 	// Garbage collection
 	if (wm->cycles_since_collection >= 0) {
 		dbprintf("-- Collecting --\n");
-		global_collect();
+		if (tracing(wm)) {
+			double start = trace_now();
+			size_t freed = gc_collect(&wm->gc);
+			// Collections happen constantly, so only the ones that
+			// found something are worth a place on the timeline
+			if (freed > 0) trace_gc(wm, start, freed);
+		} else {
+			gc_collect(&wm->gc);
+		}
 		wm->cycles_since_collection = 0;
 	} else {
 		wm->cycles_since_collection += 1;
@@ -676,11 +1200,55 @@ void winter_machine_step(Winter_Machine * wm)
 
 void winter_machine_prime(Winter_Machine * wm, BC_Chunk * bytecode)
 {
+	internal_assert(wm->fiber == wm->main_fiber);
 	internal_assert(sb_count(wm->call_stack) == 1);
 	Call_Frame * base_frame = sb_last(wm->call_stack);
 	base_frame->bytecode = bytecode;
 	base_frame->ip = 0;
 	wm->running = true;
+	// Values created from here on belong to this machine
+	gc_make_current(&wm->gc);
+}
+
+// Runs func to completion on an idle machine. The result is no longer
+// referenced by the machine, so it has to be used or copied before the
+// machine steps again.
+Value winter_machine_call(Winter_Machine * wm, Value func,
+						  Value * args, size_t arg_count, Assoc_Source assoc)
+{
+	BC_Chunk * bytecode = NULL;
+	sb_push(bytecode, bc_chunk_new_call(arg_count));
+	sb_last(bytecode).assoc = assoc;
+	winter_machine_prime(wm, bytecode);
+	for (int i = 0; i < arg_count; i++) {
+		push(args[i]);
+	}
+	push(func);
+	while (wm->running) {
+		winter_machine_step(wm);
+	}
+	winter_machine_join_fibers(wm);
+	sb_free(bytecode);
+	return pop();
+}
+
+void winter_machine_join_fibers(Winter_Machine * wm)
+{
+	while (winter_machine_waiting_fibers(wm) > 0) {
+		// Main has nothing left to do, so it just waits its turn
+		// until the others are done
+		winter_machine_prime(wm, NULL);
+		if (winter_machine_runnable_fibers(wm) == 0) {
+			// Everything left is waiting on I/O
+			double wait_start = tracing(wm) ? trace_now() : 0;
+			reactor_wait(&wm->reactor, &wm->fibers, -1);
+			if (tracing(wm)) trace_span(wm, "wait for I/O", "io", wait_start);
+		}
+		winter_machine_switch_fiber(wm, SWITCH_YIELD);
+		while (wm->running) {
+			winter_machine_step(wm);
+		}
+	}
 }
 
 // :\ Winter_Machine
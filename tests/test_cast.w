@@ -2,3 +2,5 @@ print(5.0 as int);
 print(1 as bool);
 print("16" as int);
 print(100 as bool as int);
+# Longer than any fixed buffer
+print(range(200) as string);
@@ -6,3 +6,98 @@ dict["b"] = 55;
 print(dict, dict["b"]);
 dict["k"] = 12;
 print(dict);
+
+# Keys of different types never match each other
+mixed = {1 -> "int", 1.0 -> "float", "1" -> "string", true -> "bool", int -> "type"};
+print(mixed[1], mixed[1.0], mixed["1"], mixed[true], mixed[int]);
+print(mixed[-0.0 + 1.0]);
+
+# Enough keys to grow the table several times
+big = {};
+for i in range(1000) {
+	big[i] = i * 2;
+	big[i as string] = i;
+}
+print(big[0], big[999], big["500"]);
+
+print(dict_remove(dict, "a"), dict);
+for i in range(1000) {
+	if i != 7 {
+		dict_remove(big, i);
+	}
+}
+print(big[7], big["7"]);
+# Re-adding after removal reuses tombstones
+for i in range(10) {
+	big[i] = i;
+}
+print(big[3], big[7]);
+
+# Entries keep insertion order through removals
+order = {"x" -> 1, "y" -> 2, "z" -> 3};
+dict_remove(order, "y");
+order["w"] = 4;
+order["y"] = 5;
+for key in order {
+	print(key, order[key]);
+}
+
+# Assigning into a dictionary leaves nothing behind on the eval stack,
+# so a call doing it can sit inside a list literal
+func mark(d, k) {
+	d[k] = k * 2;
+	return k;
+}
+marks = {};
+print([mark(marks, 1), mark(marks, 2)], marks);
+
+# Dictionaries built with the same string keys share a shape, and one
+# access site sees several shapes
+func point(x, y) {
+	p = {};
+	p["x"] = x;
+	p["y"] = y;
+	return p;
+}
+func norm(p) {
+	return p["x"] * p["x"] + p["y"] * p["y"];
+}
+points = [point(1, 2), point(3, 4), {"y" -> 5, "x" -> 6}, {"x" -> 7, "y" -> 8, "z" -> 9}];
+for p in points {
+	print(norm(p));
+	p["x"] = p["x"] + 1;
+}
+print(points);
+
+# Leaving the shape for the hash table keeps every entry
+shaped = {"a" -> 1, "b" -> [2, 3]};
+shaped[4] = "four";
+print(shaped, shaped["b"]);
+shaped = {"a" -> 1, "b" -> 2, "c" -> 3};
+print(dict_remove(shaped, "b"), shaped, shaped["c"]);
+wide = {};
+for i in range(20) {
+	wide[i as string] = i;
+}
+print(wide["3"], wide["19"], wide);
+
+# Keys made at runtime find the same slots as literal keys
+built = {};
+built[1 as string] = "one";
+built[true as string] = "yes";
+built["x"[0]] = "ex";
+print(built["1"], built["true"], built["x"], built);
+built["1"] = "uno";
+print(built[1 as string], built["true"] == "yes", "x"[0] == "x");
+
+# Something stored in a dictionary stays alive for as long as anything
+# holding the dictionary does, and what it replaced doesn't
+func box(d, k) {
+	d[k] = [k, 0];
+	d[k] = [k];
+	return k;
+}
+boxes = {};
+print([box(boxes, "a"), box(boxes, "b")], boxes);
+filler = [[1], [2], [3]];
+print(boxes, filler);
@@ -0,0 +1,89 @@
+func worker(name, n, out) {
+    i = 0;
+    while i < n {
+        send(out, [name, i]);
+        yield_fiber();
+        i = i + 1;
+    }
+}
+
+results = channel();
+go(worker, "a", 3, results);
+go(worker, "b", 3, results);
+i = 0;
+while i < 6 {
+    print(receive(results));
+    i = i + 1;
+}
+
+# A receive with nothing to take lets the other fibers run
+func echo(requests, replies) {
+    loop {
+        request = receive(requests);
+        if request < 0 {
+            break;
+        }
+        send(replies, request * 10);
+    }
+}
+
+requests = channel();
+replies = channel();
+go(echo, requests, replies);
+send(requests, 1);
+send(requests, 2);
+print(receive(replies), receive(replies));
+send(requests, -1);
+
+# Lots of fibers are cheap
+func add_to(total, x) {
+    send(total, x);
+}
+total = channel();
+i = 0;
+while i < 1000 {
+    go(add_to, total, i);
+    i = i + 1;
+}
+sum = 0;
+i = 0;
+while i < 1000 {
+    sum = sum + receive(total);
+    i = i + 1;
+}
+print(sum);
+
+# A receive with nothing to take waits alongside fibers parked on I/O
+func slow_square(n) {
+    i = 0;
+    while i < 20000 {
+        i = i + 1;
+    }
+    return n * n;
+}
+func read_one(fd, out) {
+    send(out, fd_read(fd, 64));
+}
+func squared(n, out) {
+    send(out, slow_square(n));
+}
+ends = fd_pipe();
+lines = channel();
+go(read_one, ends[0], lines);
+squares = channel();
+worker = spawn(squared, 9, squares);
+print(receive(squares));
+join(worker);
+fd_write(ends[1], "woken");
+print(receive(lines));
+fd_close(ends[0]);
+fd_close(ends[1]);
+
+# Fibers still running at the end get to finish
+func later(x) {
+    yield_fiber();
+    print("finished", x);
+}
+go(later, 1);
+go(later, 2);
+print("main done");
@@ -0,0 +1,82 @@
+for i in range(3) {
+    print(i);
+}
+for i in range(2, 5) {
+    print(i);
+}
+for i in range(10, 0, -3) {
+    print(i);
+}
+for i in range(5, 5) {
+    print("never");
+}
+
+# Bounds are evaluated once, up front
+n = 3;
+for i in range(n) {
+    n = n + 1;
+}
+print(n);
+
+for x in ["a", "b", "c"] {
+    print(x);
+}
+
+d = {"one" -> 1, "two" -> 2};
+for k in d {
+    print(k, d[k]);
+}
+
+# break and continue
+total = 0;
+for i in range(100) {
+    if i == 10 {
+        break;
+    }
+    if i == 5 {
+        continue;
+    }
+    total = total + i;
+}
+print(total);
+
+# Nested loops
+for i in range(1, 3) {
+    for j in range(i) {
+        print(i, j);
+    }
+}
+
+# Appending while iterating sees the new elements
+l = [1, 2];
+for x in l {
+    if x < 4 {
+        list_append(l, x + 2);
+    }
+}
+print(l);
+
+# Returning from inside a for loop
+func find(items, target) {
+    for i in range(list_count(items)) {
+        if items[i] == target {
+            return i;
+        }
+    }
+    return -1;
+}
+print(find([5, 6, 7], 7), find([5, 6, 7], 8));
+
+# Generators can yield from a for loop
+func evens(n) {
+    for i in range(0, n, 2) {
+        yield i;
+    }
+}
+g = evens(5);
+print(next(g), next(g), next(g), done(g));
+
+# range can also be used as a plain list
+r = range(4);
+print(r, typeof(r));
+print(range(3, 0, -1));
@@ -0,0 +1,67 @@
+func count_up(start, end) {
+    i = start;
+    while i < end {
+        yield i;
+        i = i + 1;
+    }
+}
+
+g = count_up(0, 3);
+print(typeof(g), done(g));
+print(next(g), next(g), next(g));
+print(next(g), done(g));
+print(next(g));
+
+# Generators compose into lazy pipelines
+func squares(source) {
+    loop {
+        x = next(source);
+        if done(source) {
+            break;
+        }
+        yield x * x;
+    }
+}
+
+func take(source, n) {
+    out = [];
+    while list_count(out) < n {
+        list_append(out, next(source));
+    }
+    return out;
+}
+
+func naturals() {
+    n = 0;
+    loop {
+        yield n;
+        n = n + 1;
+    }
+}
+
+print(take(squares(naturals()), 5));
+
+# The value of return is what the last next() gets
+func two() {
+    yield "one";
+    return "two";
+}
+t = two();
+print(next(t), next(t), done(t));
+
+# Abandoned generators are cleaned up
+i = 0;
+while i < 100 {
+    h = naturals();
+    next(h);
+    i = i + 1;
+}
+print(next(h));
+
+# Generators can be sent to isolates; they continue from where they were
+func rest(gen) {
+    return take(gen, 3);
+}
+n = naturals();
+next(n);
+print(join(spawn(rest, n)), next(n));
@@ -0,0 +1,73 @@
+# A reader waiting on an empty pipe lets the writer run
+func reader(fd, out) {
+    got = [];
+    loop {
+        chunk = fd_read(fd, 64);
+        if chunk == "" {
+            break;
+        }
+        list_append(got, chunk);
+    }
+    fd_close(fd);
+    send(out, got);
+}
+
+func writer(fd, parts) {
+    i = 0;
+    while i < list_count(parts) {
+        fd_write(fd, parts[i]);
+        yield_fiber();
+        i = i + 1;
+    }
+    fd_close(fd);
+}
+
+ends = fd_pipe();
+done_reading = channel();
+go(reader, ends[0], done_reading);
+go(writer, ends[1], ["stream", "ed ", "text"]);
+print(receive(done_reading));
+
+# Connections over a Unix socket, each handled by its own fiber. Paths
+# are relative to the scratch directory run_tests starts each test in.
+path = "io.sock";
+server = unix_listen(path);
+
+func handle(client) {
+    request = fd_read(client, 64);
+    fd_write(client, request);
+    fd_close(client);
+}
+
+func serve(count) {
+    i = 0;
+    while i < count {
+        go(handle, unix_accept(server));
+        i = i + 1;
+    }
+}
+
+func ask(message, out) {
+    fd = unix_connect(path);
+    fd_write(fd, message);
+    send(out, fd_read(fd, 64));
+    fd_close(fd);
+}
+
+go(serve, 2);
+answers = channel();
+go(ask, "one", answers);
+go(ask, "two", answers);
+first = receive(answers);
+second = receive(answers);
+print(first == "one" or second == "one", first == "two" or second == "two");
+fd_close(server);
+
+# Files
+path = "io.txt";
+out = fd_open(path, "w");
+fd_write(out, "line\n");
+fd_close(out);
+input = fd_open(path, "r");
+print(fd_read(input, 100));
+fd_close(input);
@@ -0,0 +1,40 @@
+func fib(n) {
+    if n < 2 {
+        return n;
+    }
+    return fib(n - 1) + fib(n - 2);
+}
+
+func work(n, results) {
+    send(results, [n, fib(n)]);
+    return n * 2;
+}
+
+results = channel();
+a = spawn(work, 10, results);
+b = spawn(work, 12, results);
+print(join(a), join(b));
+
+got = {};
+i = 0;
+while i < 2 {
+    pair = receive(results);
+    got[pair[0]] = pair[1];
+    i = i + 1;
+}
+print(got[10], got[12]);
+
+# Spawned functions get copies, not the originals
+xs = [1, 2, 3];
+func grow(l) {
+    list_append(l, 4);
+    return l;
+}
+print(join(spawn(grow, xs)), xs);
+
+record Point { x, y }
+func make_point(x, y) {
+    return Point(x, y);
+}
+print(join(spawn(make_point, 1, "two")));
+print(join(spawn(list_count, xs)));
@@ -0,0 +1,64 @@
+func square(x) {
+    return x * x;
+}
+
+func is_small(x) {
+    return x < 50;
+}
+
+func add(a, b) {
+    return a + b;
+}
+
+xs = [];
+i = 0;
+while i < 100 {
+    list_append(xs, i);
+    i = i + 1;
+}
+
+squares = par_map(square, xs);
+print(squares[0], squares[7], squares[99], list_count(squares));
+small = par_filter(is_small, xs);
+print(small[0], small[1], small[49], list_count(small));
+print(par_reduce(add, xs, 0), par_reduce(add, [], 5));
+
+# Globals and closures come along
+offset = 1000;
+func shift(x) {
+    return x + offset;
+}
+print(par_map(shift, [1, 2, 3]));
+print(par_map(typeof, [1, "a", [2]]));
+
+# Functions that build and return new values are fine
+record Pair { a, b }
+func pair(x) {
+    return Pair(x, [x, x]);
+}
+print(par_map(pair, [1, 2]));
+
+# Mutating functions need to be declared pure
+func with_last(l) {
+    list_append(l, 0);
+    return l;
+}
+print(par_map(pure(with_last), [[1], [2, 3]]));
+print(par_map(square, []));
+
+# Only what a function looks up has to be pure
+func stamp(x) {
+    d = {};
+    d["a"] = x;
+    return d;
+}
+func get_v(x) {
+    return x["v"];
+}
+print(par_map(get_v, [{"v" -> 3}]));
+
+# Functions handed in as items are called too, so they have to be pure
+func call_one(f) {
+    return f(2);
+}
+print(par_map(call_one, [square, typeof]));
@@ -0,0 +1,70 @@
+# Vectors and maps never change; every update gives a new one
+v = vector([1, 2, 3]);
+w = vector_append(v, 4);
+u = vector_set(w, 0, "one");
+print(v, w, u);
+print(typeof(v), vector_count(w), u[0], w[3]);
+print(v as list);
+
+# Enough elements for several levels of the trie, with snapshots
+# taken along the way sharing all but a path of it
+big = vector();
+snapshots = [];
+for i in range(1100) {
+	big = vector_append(big, i * 2);
+	if i == 0 or i == 31 or i == 32 or i == 1023 or i == 1024 {
+		list_append(snapshots, big);
+	}
+}
+changed = vector_set(big, 1034, "changed");
+print(vector_count(big), big[1099], big[1034], changed[1034], changed[1035]);
+for s in snapshots {
+	print(vector_count(s), s[vector_count(s) - 1]);
+}
+total = 0;
+for x in vector(range(100)) {
+	total = total + x;
+}
+print(total);
+
+# Elements that are collections stay alive as long as a vector has them
+nested = vector([[1, 2], {"k" -> "v"}]);
+list_append(nested[0], 3);
+print(nested);
+
+m = map({"a" -> 1, "b" -> 2});
+n = map_set(m, "c", 3);
+o = map_remove(n, "a");
+print(m["a"], n["c"], map_count(m), map_count(n), map_count(o));
+print(typeof(m), o);
+keys = 0;
+for k in n {
+	keys = keys + n[k];
+}
+print(keys);
+
+grown = map();
+for i in range(400) {
+	grown = map_set(grown, i, i * i);
+	grown = map_set(grown, i as string, i);
+}
+before = grown;
+for i in range(0, 400, 2) {
+	grown = map_remove(grown, i);
+}
+print(map_count(before), map_count(grown), grown[399], grown["42"], before[42]);
+print(map_set(map(), 1.0, "float")[1.0], map_set(map(), true, "bool")[true]);
+
+# Isolates get their own copy
+func sum_vector(v) {
+	total = 0;
+	for x in v {
+		total = total + x;
+	}
+	return total;
+}
+print(join(spawn(sum_vector, vector(range(1000)))));
+func map_total(m) {
+	return map_count(m) + m["x"];
+}
+print(join(spawn(map_total, map({"x" -> 10, "y" -> 20}))));
@@ -12,3 +12,53 @@ print(x);
 
 x.field_a = 15;
 print(x.field_a, x);
+
+# Assigned fields keep what they hold alive
+record Pair {
+	left,
+	right,
+}
+p = Pair(1, 2);
+p.right = [3, 4];
+p.left = "left";
+other = [5, 6];
+print(p.right, p.left, p);
+
+record Vec {
+	x,
+	y,
+	z,
+}
+v = Vec(1, 2);
+print(v, v.z);
+v.z = v.x + v.y;
+v.y = [v.x, v.z];
+print(v.z, v.y, v);
+
+# One access site seeing several record types, with x in a different
+# slot in each, and more types than it remembers
+record A { x, }
+record B { y, x, }
+record C { y, z, x, }
+record D { w, y, z, x, }
+record E { v, w, y, z, x, }
+func get_x(r) {
+	return r.x;
+}
+for r in [A(1), B(0, 2), C(0, 0, 3), D(0, 0, 0, 4), E(0, 0, 0, 0, 5), A(6), C(0, 0, 7)] {
+	print(get_x(r));
+}
+
+# Each call declares a new type with the same name
+func make(first) {
+	if first {
+		record T { a, b, }
+		return T(1, 2);
+	}
+	record T { b, a, }
+	return T(3, 4);
+}
+for first in [true, false, true, false] {
+	t = make(first);
+	print(t.a, t.b);
+}
@@ -1,2 +1,40 @@
 x = "123456";
 print(x[3]);
+
+# Characters and other short strings live in the value itself
+counts = {"m" -> 0, "i" -> 0, "s" -> 0, "p" -> 0};
+word = "mississippi";
+for i in range(11) {
+	c = word[i];
+	counts[c] = counts[c] + 1;
+}
+print(counts);
+print(word[0] == "m", word[1] == word[4], word[2] == "i");
+
+func greeting() {
+	return "hello";
+}
+print(greeting() == greeting(), greeting());
+print(true as string, false as string, [word[0], "none"]);
+
+func first(s) {
+	return s[0];
+}
+print(join(spawn(first, "winter")), join(spawn(greeting)));
+
+# Short and long strings made at runtime match the literals, either side
+# of the longest that fits in a value
+print(123456 as string == "123456", 1234567 as string == "1234567");
+print(list_count(["abcdef", "abcdefg"]), (-12345 as string)[0], 7654321 as string);
+
+# Long strings go to other machines without copying their characters,
+# and outlive the machine that made them
+func numbers(n) {
+	return range(n) as string;
+}
+made = join(spawn(numbers, 12));
+print(made, made == range(12) as string);
+func echo(s) {
+	return s;
+}
+print(join(spawn(echo, made)) == made);